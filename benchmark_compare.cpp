@@ -0,0 +1,160 @@
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <yaml-cpp/yaml.h>
+
+#include "benchmark_compare.hpp"
+
+using namespace std;
+
+
+vector<benchmark_result> read_results_json(istream &is)
+{
+    YAML::Node root = YAML::Load(is);
+    YAML::Node results = root["results"];
+
+    if (!results || !results.IsSequence())
+	throw runtime_error("read_results_json(): expected a 'results' list");
+
+    vector<benchmark_result> ret;
+
+    for (const YAML::Node &n: results) {
+	benchmark_result r;
+	r.benchmark = n["benchmark"].as<string> ();
+	r.name = n["name"].as<string> ();
+	r.params.nthreads = n["nthreads"].as<int> ();
+	r.params.nbytes = n["nbytes"].as<ssize_t> ();
+	r.nbytes_accessed = n["nbytes_accessed"].as<ssize_t> ();
+	r.ninterference = n["ninterference"] ? n["ninterference"].as<ssize_t> () : 0;
+	r.samples = n["samples"].as<vector<double>> ();
+	r.stats = compute_timing_statistics(r.samples);
+
+	string pinning = n["pinning"].as<string> ();
+	r.params.pin_to_core = (pinning != "none");
+	if (r.params.pin_to_core)
+	    r.params.pinning = pinning_policy_from_string(pinning);
+
+	ret.push_back(r);
+    }
+
+    return ret;
+}
+
+
+vector<benchmark_result> read_results_json(const string &filename)
+{
+    ifstream f(filename);
+    if (!f)
+	throw runtime_error("read_results_json(): couldn't open '" + filename + "'");
+
+    try {
+	return read_results_json(f);
+    } catch (std::exception &e) {
+	throw runtime_error("read_results_json(): couldn't parse '" + filename + "': " + e.what());
+    }
+}
+
+
+double mann_whitney_p_value(const vector<double> &x, const vector<double> &y)
+{
+    double nx = x.size();
+    double ny = y.size();
+
+    if ((nx < 3) || (ny < 3))
+	return 1.0;
+
+    // U = number of pairs with x > y (ties count 1/2).
+    double u = 0.0;
+    for (double xi: x)
+	for (double yj: y)
+	    u += (xi > yj) ? 1.0 : ((xi == yj) ? 0.5 : 0.0);
+
+    // Tie correction: sum over groups of tied values of (t^3 - t).
+    vector<double> v(x);
+    v.insert(v.end(), y.begin(), y.end());
+    std::sort(v.begin(), v.end());
+
+    double tsum = 0.0;
+    for (size_t i = 0; i < v.size(); ) {
+	size_t j = i;
+	while ((j < v.size()) && (v[j] == v[i]))
+	    j++;
+	double t = j - i;
+	tsum += t*t*t - t;
+	i = j;
+    }
+
+    double n = nx + ny;
+    double mean = nx * ny / 2.;
+    double var = nx * ny / 12. * ((n+1) - tsum / (n * (n-1)));
+
+    if (var <= 0.0)
+	return 1.0;
+
+    double z = (u - mean - 0.5) / sqrt(var);
+    return 0.5 * erfc(z / sqrt(2.));
+}
+
+
+static string describe(const benchmark_result &r)
+{
+    stringstream ss;
+    ss << r.benchmark << "/" << r.name << " nthreads=" << r.params.nthreads
+       << " pinning=" << (r.params.pin_to_core ? pinning_policy_name(r.params.pinning) : "none")
+       << " nbytes=" << r.params.nbytes;
+    return ss.str();
+}
+
+
+vector<benchmark_comparison> compare_results(const vector<benchmark_result> &baseline, const vector<benchmark_result> &current, double threshold, double alpha)
+{
+    vector<benchmark_comparison> ret;
+
+    for (const benchmark_result &r: current) {
+	string d = describe(r);
+
+	auto b = std::find_if(baseline.begin(), baseline.end(), [&d](const benchmark_result &x) { return describe(x) == d; });
+	if (b == baseline.end())
+	    continue;
+
+	benchmark_comparison c;
+	c.description = d;
+	c.baseline_median = compute_timing_statistics(b->samples).median;
+	c.median = compute_timing_statistics(r.samples).median;
+	c.ratio = (c.baseline_median > 0.0) ? (c.median / c.baseline_median) : 1.0;
+	c.p_slower = mann_whitney_p_value(r.samples, b->samples);
+	c.p_faster = mann_whitney_p_value(b->samples, r.samples);
+	c.regression = (c.ratio > 1.0 + threshold) && (c.p_slower < alpha);
+	c.improvement = (c.ratio < 1.0 - threshold) && (c.p_faster < alpha);
+	c.ninterference = r.ninterference + b->ninterference;
+	ret.push_back(c);
+    }
+
+    return ret;
+}
+
+
+int print_comparison(const vector<benchmark_comparison> &v, ostream &os)
+{
+    int nregressions = 0;
+
+    for (const benchmark_comparison &c: v) {
+	os << c.description << ": median " << c.median << " (baseline " << c.baseline_median
+	   << "), ratio " << c.ratio;
+
+	if (c.regression)
+	    os << ", REGRESSION (p=" << c.p_slower << ")";
+	else if (c.improvement)
+	    os << ", improvement (p=" << c.p_faster << ")";
+
+	if (c.ninterference > 0)
+	    os << " [" << c.ninterference << " trials flagged for interference]";
+
+	os << endl;
+	nregressions += c.regression ? 1 : 0;
+    }
+
+    os << v.size() << " results compared, " << nregressions << " regressions" << endl;
+    return nregressions;
+}
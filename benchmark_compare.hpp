@@ -0,0 +1,51 @@
+#ifndef _BENCHMARK_COMPARE_HPP
+#define _BENCHMARK_COMPARE_HPP
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "benchmark_registry.hpp"
+
+
+// Regression detection: compares a run against a stored baseline (a JSON file written by
+// write_results_json(), e.g. 'run-benchmarks -o baseline.json').  Results are matched on
+// (benchmark, name, nthreads, pinning, nbytes).  A result is a regression if its median is slower
+// than the baseline median by more than 'threshold' (fractional), AND a one-sided Mann-Whitney U
+// test on the per-trial samples rejects "not slower" at significance level 'alpha'.  Improvements
+// are detected symmetrically.
+
+
+// Parses JSON written by write_results_json() (via yaml-cpp, since JSON is a subset of YAML).
+// Throws an exception on failure.
+extern std::vector<benchmark_result> read_results_json(std::istream &is);
+extern std::vector<benchmark_result> read_results_json(const std::string &filename);
+
+// One-sided Mann-Whitney U test: returns the p-value for the hypothesis that samples in 'x'
+// tend to be larger than samples in 'y' (normal approximation, with tie and continuity corrections).
+// Returns 1.0 if either sample has fewer than 3 elements.
+extern double mann_whitney_p_value(const std::vector<double> &x, const std::vector<double> &y);
+
+
+struct benchmark_comparison {
+    std::string description;    // "benchmark/name nthreads=N pinning=P nbytes=B"
+    double baseline_median = 0.0;
+    double median = 0.0;
+    double ratio = 0.0;         // median / baseline_median (> 1 means slower)
+    double p_slower = 1.0;      // Mann-Whitney p-values
+    double p_faster = 1.0;
+    bool regression = false;
+    bool improvement = false;
+    ssize_t ninterference = 0;  // trials flagged for interference, in either run
+};
+
+// Results with no counterpart in the baseline are skipped.
+extern std::vector<benchmark_comparison> compare_results(const std::vector<benchmark_result> &baseline,
+							 const std::vector<benchmark_result> &current,
+							 double threshold=0.05, double alpha=0.01);
+
+// Returns the number of regressions.
+extern int print_comparison(const std::vector<benchmark_comparison> &v, std::ostream &os=std::cout);
+
+
+#endif  // _BENCHMARK_COMPARE_HPP
@@ -0,0 +1,235 @@
+#include <ctime>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+
+#include "benchmark_registry.hpp"
+#include "memory_utils.hpp"
+
+using namespace std;
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// Registry
+
+
+vector<benchmark_info> &get_benchmark_registry()
+{
+    // Function-local static, so that registration from static initializers in other
+    // translation units is safe regardless of initialization order.
+    static vector<benchmark_info> registry;
+    return registry;
+}
+
+
+void register_benchmark(const benchmark_info &b)
+{
+    for (const benchmark_info &r: get_benchmark_registry())
+	if (r.name == b.name)
+	    throw runtime_error("register_benchmark(): duplicate benchmark name '" + b.name + "'");
+
+    get_benchmark_registry().push_back(b);
+}
+
+
+vector<benchmark_info> match_benchmarks(const string &patterns)
+{
+    vector<string> pv;
+    stringstream ss(patterns);
+    string p;
+
+    while (getline(ss, p, ','))
+	if (p.size() > 0)
+	    pv.push_back(p);
+
+    vector<benchmark_info> ret;
+
+    for (const benchmark_info &b: get_benchmark_registry()) {
+	for (const string &p: pv) {
+	    if (fnmatch(p.c_str(), b.name.c_str(), 0) == 0) {
+		ret.push_back(b);
+		break;
+	    }
+	}
+    }
+
+    return ret;
+}
+
+
+vector<benchmark_result> run_benchmark(const benchmark_info &b, const benchmark_params &params)
+{
+    auto pool = make_shared<timing_thread_pool> (params.nthreads, params.timer, params.barrier, params.pinning);
+    pool->verbose = false;
+
+    vector<thread> threads(params.nthreads);
+    for (int i = 0; i < params.nthreads; i++)
+	threads[i] = thread(timing_thread::_thread_main, b.make_thread(pool, params));
+    for (int i = 0; i < params.nthreads; i++)
+	threads[i].join();
+
+    vector<benchmark_result> ret;
+
+    for (const string &name: pool->get_sample_names()) {
+	benchmark_result r;
+	r.benchmark = b.name;
+	r.name = name;
+	r.params = params;
+	r.nbytes_accessed = pool->get_nbytes_accessed(name);
+	r.ninterference = pool->get_num_interference_flagged(name);
+	r.samples = pool->get_samples(name);
+	r.stats = compute_timing_statistics(r.samples);
+	ret.push_back(r);
+    }
+
+    return ret;
+}
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// Host metadata
+
+
+static string get_cpu_model()
+{
+    ifstream f("/proc/cpuinfo");
+    string line;
+
+    while (getline(f, line)) {
+	if (line.compare(0, 10, "model name") != 0)
+	    continue;
+	size_t pos = line.find(':');
+	if (pos != string::npos)
+	    return line.substr(min(pos+2, line.size()));
+    }
+
+    return "unknown";
+}
+
+
+vector<pair<string,string>> get_host_metadata()
+{
+    vector<pair<string,string>> ret;
+    const cpu_topology &topo = get_cpu_topology();
+
+    char hostname[256];
+    if (gethostname(hostname, sizeof(hostname)) != 0)
+	hostname[0] = 0;
+    hostname[sizeof(hostname)-1] = 0;
+
+    struct utsname u;
+    string kernel = (uname(&u) == 0) ? (string(u.sysname) + " " + u.release + " " + u.machine) : "unknown";
+
+    char timestamp[64];
+    time_t t = time(NULL);
+    struct tm tm;
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&t, &tm));
+
+    ret.push_back({ "hostname", hostname });
+    ret.push_back({ "kernel", kernel });
+    ret.push_back({ "cpu_model", get_cpu_model() });
+    ret.push_back({ "ncpus", to_string(topo.cpus.size()) });
+    ret.push_back({ "nphysical_cores", to_string(topo.nphysical_cores) });
+    ret.push_back({ "npackages", to_string(topo.npackages) });
+    ret.push_back({ "nnodes", to_string(topo.nnodes) });
+    ret.push_back({ "l1d_nbytes", to_string(topo.l1d_nbytes) });
+    ret.push_back({ "l2_nbytes", to_string(topo.l2_nbytes) });
+    ret.push_back({ "l3_nbytes", to_string(topo.l3_nbytes) });
+    ret.push_back({ "physical_memory", to_string(get_physical_memory()) });
+    ret.push_back({ "compiler", __VERSION__ });
+    ret.push_back({ "timestamp", timestamp });
+
+    return ret;
+}
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// Output
+
+
+static string json_escape(const string &s)
+{
+    stringstream ss;
+    ss << '"';
+
+    for (char c: s) {
+	if ((c == '"') || (c == '\\'))
+	    ss << '\\' << c;
+	else if ((unsigned char)c < 0x20)
+	    ss << "\\u" << hex << setw(4) << setfill('0') << int(c) << dec << setfill(' ');
+	else
+	    ss << c;
+    }
+
+    ss << '"';
+    return ss.str();
+}
+
+
+void write_results_json(ostream &os, const vector<benchmark_result> &results)
+{
+    auto host = get_host_metadata();
+    auto prec = os.precision(10);
+
+    os << "{\n  \"host\": {";
+    for (size_t i = 0; i < host.size(); i++)
+	os << (i ? ",\n    " : "\n    ") << json_escape(host[i].first) << ": " << json_escape(host[i].second);
+    os << "\n  },\n  \"results\": [";
+
+    for (size_t i = 0; i < results.size(); i++) {
+	const benchmark_result &r = results[i];
+
+	os << (i ? ",\n    {" : "\n    {")
+	   << " \"benchmark\": " << json_escape(r.benchmark)
+	   << ", \"name\": " << json_escape(r.name)
+	   << ", \"nthreads\": " << r.params.nthreads
+	   << ", \"pinning\": " << json_escape(r.params.pin_to_core ? pinning_policy_name(r.params.pinning) : "none")
+	   << ", \"nbytes\": " << r.params.nbytes
+	   << ", \"nbytes_accessed\": " << r.nbytes_accessed
+	   << ", \"ntrials\": " << r.stats.ntrials
+	   << ", \"ninterference\": " << r.ninterference
+	   << ", \"min\": " << r.stats.min
+	   << ", \"median\": " << r.stats.median
+	   << ", \"p99\": " << r.stats.p99
+	   << ", \"mean\": " << r.stats.mean
+	   << ", \"stddev\": " << r.stats.stddev
+	   << ", \"samples\": [";
+
+	for (size_t j = 0; j < r.samples.size(); j++)
+	    os << (j ? ", " : " ") << r.samples[j];
+
+	os << " ] }";
+    }
+
+    os << "\n  ]\n}" << endl;
+    os.precision(prec);
+}
+
+
+void write_results_csv(ostream &os, const vector<benchmark_result> &results)
+{
+    auto prec = os.precision(10);
+
+    for (const auto &kv: get_host_metadata())
+	os << "# " << kv.first << ": " << kv.second << "\n";
+
+    os << "benchmark,name,nthreads,pinning,nbytes,nbytes_accessed,ntrials,ninterference,min,median,p99,mean,stddev\n";
+
+    for (const benchmark_result &r: results) {
+	os << r.benchmark << "," << r.name << "," << r.params.nthreads
+	   << "," << (r.params.pin_to_core ? pinning_policy_name(r.params.pinning) : "none")
+	   << "," << r.params.nbytes << "," << r.nbytes_accessed << "," << r.stats.ntrials << "," << r.ninterference
+	   << "," << r.stats.min << "," << r.stats.median << "," << r.stats.p99
+	   << "," << r.stats.mean << "," << r.stats.stddev << "\n";
+    }
+
+    os.flush();
+    os.precision(prec);
+}
@@ -0,0 +1,133 @@
+#ifndef _BENCHMARK_REGISTRY_HPP
+#define _BENCHMARK_REGISTRY_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <iostream>
+#include <functional>
+
+#include "timing_thread.hpp"
+
+
+// Registry of named benchmarks, run by the 'run-benchmarks' binary.  A benchmark is a subclass
+// of benchmark_thread (a timing_thread which knows its parameters), registered with a static
+// benchmark_registrar:
+//
+//   class my_benchmark : public benchmark_thread {
+//   public:
+//       my_benchmark(const std::shared_ptr<timing_thread_pool> &pool, const benchmark_params &params) :
+//           benchmark_thread(pool, params) { }
+//
+//       virtual void thread_body() override
+//       {
+//           this->name = "my_kernel";            // every name timed becomes one result
+//           this->nbytes_accessed = ...;         // per thread, optional
+//           this->run_trials([&]() { ... });      // params.ntrials trials
+//       }
+//   };
+//
+//   static benchmark_registrar<my_benchmark> reg("group/my_benchmark", "one-line description");
+//
+// Benchmark names are hierarchical by convention ("memory/stream"), so that groups can be
+// selected with shell-style patterns ("memory/*").
+
+
+struct benchmark_params {
+    int nthreads = 1;
+    pinning_policy pinning = PIN_SEQUENTIAL;
+    bool pin_to_core = true;
+    bool warm_up_cpu = true;
+    bool monitor_interference = false;   // see timing_thread::monitor_interference
+    int ntrials = 10;
+    timer_type timer = TIMER_MONOTONIC;
+    barrier_type barrier = BARRIER_MUTEX;
+
+    // Per-thread working set, for benchmarks which have one.
+    ssize_t nbytes = 64 << 20;
+};
+
+
+class benchmark_thread : public timing_thread {
+public:
+    const benchmark_params params;
+
+    benchmark_thread(const std::shared_ptr<timing_thread_pool> &pool_, const benchmark_params &params_) :
+	timing_thread(pool_, params_.pin_to_core, params_.warm_up_cpu), params(params_)
+    {
+	this->monitor_interference = params.monitor_interference;
+    }
+
+    virtual ~benchmark_thread() { }
+
+protected:
+    // Runs params.ntrials trials (see timing_thread::run_trials()).
+    template<typename F>
+    void run_trials(const F &f)
+    {
+	timing_thread::run_trials(params.ntrials, f);
+    }
+};
+
+
+struct benchmark_info {
+    std::string name;
+    std::string description;
+    std::function<timing_thread * (const std::shared_ptr<timing_thread_pool> &, const benchmark_params &)> make_thread;
+};
+
+// In order of registration.
+extern std::vector<benchmark_info> &get_benchmark_registry();
+extern void register_benchmark(const benchmark_info &b);
+
+// Shell-style pattern matching (fnmatch), e.g. "memory/*".  Multiple patterns may be separated by commas.
+extern std::vector<benchmark_info> match_benchmarks(const std::string &patterns);
+
+
+template<typename T>
+struct benchmark_registrar {
+    benchmark_registrar(const std::string &name, const std::string &description)
+    {
+	benchmark_info b;
+	b.name = name;
+	b.description = description;
+	b.make_thread = [](const std::shared_ptr<timing_thread_pool> &pool, const benchmark_params &params) -> timing_thread *
+	    { return new T(pool, params); };
+
+	register_benchmark(b);
+    }
+};
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// Running benchmarks, and structured output.
+
+
+// One result per (benchmark, timed name, configuration).
+struct benchmark_result {
+    std::string benchmark;
+    std::string name;
+    benchmark_params params;
+    ssize_t nbytes_accessed = 0;    // per thread
+    ssize_t ninterference = 0;      // number of trials flagged for interference (if params.monitor_interference)
+    timing_statistics stats;
+    std::vector<double> samples;    // global_dt of each trial, in seconds
+};
+
+// Runs one benchmark (params.nthreads threads), with the benchmark's own output suppressed.
+extern std::vector<benchmark_result> run_benchmark(const benchmark_info &b, const benchmark_params &params);
+
+
+// Host metadata (hostname, kernel, cpu model, topology, compiler, time), as key/value pairs.
+extern std::vector<std::pair<std::string,std::string>> get_host_metadata();
+
+// JSON: { "host": { key: value, ... }, "results": [ { ... "samples": [ ... ] }, ... ] }
+extern void write_results_json(std::ostream &os, const std::vector<benchmark_result> &results);
+
+// CSV: host metadata as leading "# key: value" comment lines, then a header line and one row per result.
+extern void write_results_csv(std::ostream &os, const std::vector<benchmark_result> &results);
+
+
+#endif  // _BENCHMARK_REGISTRY_HPP
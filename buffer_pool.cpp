@@ -0,0 +1,147 @@
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "buffer_pool.hpp"
+
+using namespace std;
+
+
+shared_ptr<buffer_pool> buffer_pool::make(size_t nbytes, int nbuffers, buffer_pool_policy policy, int max_buffers, size_t nalign, bool zero)
+{
+    // Constructor is protected, so we can't use make_shared() here.
+    return shared_ptr<buffer_pool> (new buffer_pool(nbytes, nbuffers, policy, max_buffers, nalign, zero));
+}
+
+
+buffer_pool::buffer_pool(size_t nbytes_, int nbuffers, buffer_pool_policy policy_, int max_buffers_, size_t nalign_, bool zero_) :
+    nbytes(nbytes_),
+    nalign(nalign_),
+    zero(zero_),
+    policy(policy_),
+    max_buffers(max_buffers_ ? max_buffers_ : ((policy_ == POOL_GROW) ? (4 * nbuffers) : nbuffers)),
+    free_head(0), n_hits(0), n_misses(0), n_allocated(0), n_in_use(0), n_high_water(0), n_waiters(0)
+{
+    if (nbytes == 0)
+	throw runtime_error("buffer_pool constructor called with nbytes=0");
+    if ((nbuffers < 0) || (max_buffers < nbuffers) || (max_buffers <= 0))
+	throw runtime_error("buffer_pool constructor: invalid nbuffers=" + to_string(nbuffers) + " or max_buffers=" + to_string(max_buffers));
+    if ((policy != POOL_BLOCK) && (policy != POOL_GROW) && (policy != POOL_THROW))
+	throw runtime_error("buffer_pool constructor: invalid policy");
+
+    this->slots.reset(new slot[max_buffers]);
+
+    for (int i = 0; i < max_buffers; i++)
+	slots[i].next.store(0);
+
+    for (int i = 0; i < nbuffers; i++)
+	_push(_grow());
+}
+
+
+buffer_pool::~buffer_pool()
+{
+    int n = n_allocated.load();
+    for (int i = 0; i < n; i++)
+	aligned_free(slots[i].buf);
+}
+
+
+int buffer_pool::_pop()
+{
+    uint64_t head = free_head.load();
+
+    for (;;) {
+	int index = int(head & 0xffffffffU) - 1;
+	if (index < 0)
+	    return -1;
+
+	uint64_t next = uint64_t(slots[index].next.load());
+	uint64_t new_head = ((head >> 32) + 1) << 32 | next;
+
+	if (free_head.compare_exchange_weak(head, new_head))
+	    return index;
+    }
+}
+
+
+void buffer_pool::_push(int index)
+{
+    uint64_t head = free_head.load();
+
+    for (;;) {
+	slots[index].next.store(int(head & 0xffffffffU));
+	uint64_t new_head = ((head >> 32) + 1) << 32 | uint64_t(index+1);
+
+	if (free_head.compare_exchange_weak(head, new_head))
+	    return;
+    }
+}
+
+
+// Allocates a new buffer and returns its index, or returns -1 if max_buffers has been reached.
+int buffer_pool::_grow()
+{
+    lock_guard<mutex> l(lock);
+
+    int index = n_allocated.load();
+    if (index >= max_buffers)
+	return -1;
+
+    // Pre-faulted on the calling thread (zeroed if 'zero' is true, otherwise one byte per page is touched).
+    slots[index].buf = aligned_alloc<char> (nbytes, nalign, false);
+    parallel_first_touch(slots[index].buf, nbytes, vector<int> (), NUMA_LOCAL, zero);
+
+    n_allocated.store(index+1);
+    return index;
+}
+
+
+int buffer_pool::_acquire()
+{
+    int index = _pop();
+
+    if (index >= 0)
+	n_hits++;
+    else {
+	n_misses++;
+
+	if (policy == POOL_THROW)
+	    throw runtime_error("buffer_pool: all " + to_string(n_allocated.load()) + " buffers are in use");
+	if (policy == POOL_GROW)
+	    index = _grow();
+
+	if (index < 0) {
+	    // Block.  The n_waiters logic pairs with _release(), which only takes the lock if there are waiters.
+	    unique_lock<mutex> l(lock);
+	    n_waiters++;
+
+	    while ((index = _pop()) < 0)
+		cv.wait(l);
+
+	    n_waiters--;
+	}
+    }
+
+    int n = ++n_in_use;
+    int hw = n_high_water.load();
+
+    while ((n > hw) && !n_high_water.compare_exchange_weak(hw, n))
+	;
+
+    return index;
+}
+
+
+void buffer_pool::_release(int index)
+{
+    if ((index < 0) || (index >= n_allocated.load()))
+	throw runtime_error("buffer_pool::_release(): invalid index");
+
+    n_in_use--;
+    _push(index);
+
+    if (n_waiters.load() > 0) {
+	lock_guard<mutex> l(lock);
+	cv.notify_all();
+    }
+}
@@ -0,0 +1,141 @@
+#ifndef _BUFFER_POOL_HPP
+#define _BUFFER_POOL_HPP
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <condition_variable>
+
+#include "memory_utils.hpp"
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// buffer_pool: a pool of pre-allocated, pre-faulted, fixed-size aligned buffers.  Buffers are
+// handed out as uptr/sptr-like handles, and returned to the pool (not freed) when the handle is
+// destroyed, so that the allocate/free cycle costs no posix_memalign(), memset(), or page faults.
+//
+//   std::shared_ptr<buffer_pool> pool = buffer_pool::make(nbytes, nbuffers);
+//
+//   pool_uptr<float> p = pool->get_uptr<float> ();             // unique_ptr<float[]>-like
+//   std::shared_ptr<float[]> q = pool->get_sptr<float> ();     // shared_ptr<float[]>
+//
+// Handles keep the pool alive, so it is safe for handles to outlive the caller's shared_ptr.
+//
+// Buffers are pre-faulted when they are first allocated (by the thread which constructs the pool, or
+// which grows it), and also zeroed if 'zero' is true.  They are NOT zeroed when they are recycled, so a
+// buffer from get_uptr() generally contains data from its previous user.
+//
+// The 'policy' constructor argument determines what happens when all buffers are in use:
+//
+//   POOL_BLOCK   wait until another thread returns a buffer
+//   POOL_GROW    allocate a new buffer (up to 'max_buffers'; after that, block)
+//   POOL_THROW   throw an exception
+//
+// Returned buffers go onto a lock-free free list, so get/release are a single CAS in the common
+// case.  The pool's mutex is only used when growing, or when some thread is blocked.
+
+
+enum buffer_pool_policy {
+    POOL_BLOCK = 0,
+    POOL_GROW = 1,
+    POOL_THROW = 2
+};
+
+
+class buffer_pool;
+
+struct buffer_pool_deleter {
+    std::shared_ptr<buffer_pool> pool;
+    int index = -1;
+
+    buffer_pool_deleter() { }
+    buffer_pool_deleter(const std::shared_ptr<buffer_pool> &pool_, int index_) : pool(pool_), index(index_) { }
+
+    inline void operator()(const void *p) const;
+};
+
+template<typename T>
+using pool_uptr = std::unique_ptr<T[], buffer_pool_deleter>;
+
+
+class buffer_pool : public std::enable_shared_from_this<buffer_pool> {
+public:
+    const size_t nbytes;        // per buffer
+    const size_t nalign;
+    const bool zero;
+    const buffer_pool_policy policy;
+    const int max_buffers;
+
+    // If 'max_buffers' is zero, it defaults to 'nbuffers' (or 4*nbuffers for POOL_GROW).
+    static std::shared_ptr<buffer_pool> make(size_t nbytes, int nbuffers, buffer_pool_policy policy=POOL_BLOCK,
+					     int max_buffers=0, size_t nalign=128, bool zero=true);
+
+    ~buffer_pool();
+
+    template<typename T>
+    inline pool_uptr<T> get_uptr()
+    {
+	int index = _acquire();
+	return pool_uptr<T> (reinterpret_cast<T *> (slots[index].buf), buffer_pool_deleter(shared_from_this(), index));
+    }
+
+    template<typename T>
+    inline std::shared_ptr<T[]> get_sptr()
+    {
+	int index = _acquire();
+	return std::shared_ptr<T[]> (reinterpret_cast<T *> (slots[index].buf), buffer_pool_deleter(shared_from_this(), index));
+    }
+
+    // Counters.  A "hit" is a request which was satisfied from the free list; a "miss" is a request
+    // which found the free list empty (and then grew, blocked, or threw).  The high-water mark is the
+    // largest number of buffers which have been in use simultaneously.
+    ssize_t num_hits() const { return n_hits.load(); }
+    ssize_t num_misses() const { return n_misses.load(); }
+    int num_allocated() const { return n_allocated.load(); }
+    int num_in_use() const { return n_in_use.load(); }
+    int high_water_mark() const { return n_high_water.load(); }
+
+    // Low-level interface: returns index of a buffer (see buffer()), which must be passed to _release().
+    int _acquire();
+    void _release(int index);
+    inline void *buffer(int index) const { return slots[index].buf; }
+
+protected:
+    buffer_pool(size_t nbytes, int nbuffers, buffer_pool_policy policy, int max_buffers, size_t nalign, bool zero);
+
+    struct slot {
+	char *buf = nullptr;
+	std::atomic<int> next;   // index+1 of next free slot, or 0
+    };
+
+    std::unique_ptr<slot[]> slots;   // length max_buffers
+
+    // Free list head: low 32 bits are (index+1) of the top slot (0 if empty), high 32 bits are a
+    // counter which is incremented on every update, to avoid the ABA problem.
+    std::atomic<uint64_t> free_head;
+
+    std::atomic<ssize_t> n_hits;
+    std::atomic<ssize_t> n_misses;
+    std::atomic<int> n_allocated;
+    std::atomic<int> n_in_use;
+    std::atomic<int> n_high_water;
+    std::atomic<int> n_waiters;
+
+    std::mutex lock;
+    std::condition_variable cv;
+
+    int _pop();
+    void _push(int index);
+    int _grow();
+};
+
+
+inline void buffer_pool_deleter::operator()(const void *p) const
+{
+    if (pool)
+	pool->_release(index);
+}
+
+
+#endif  // _BUFFER_POOL_HPP
@@ -0,0 +1,386 @@
+#include <cstdio>
+#include <cstdlib>
+#include <tuple>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "cpu_affinity.hpp"
+
+using namespace std;
+
+#ifndef CPU_SETSIZE
+#define CPU_SETSIZE 1024   // osx
+#endif
+
+
+void pin_current_thread_to_core(int core_id)
+{
+#ifdef __APPLE__
+    if (core_id == 0)
+	cerr << "warning: pinning threads to cores is not implemented in osx\n";
+    return;
+#else
+    // Note: we don't compare to hardware_concurrency() here, since cpu numbering can be sparse.
+    if ((core_id < 0) || (core_id >= CPU_SETSIZE))
+	throw runtime_error("pin_thread_to_core: core_id=" + to_string(core_id) + " is out of range");
+
+    pthread_t thread = pthread_self();
+
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    CPU_SET(core_id, &cs);
+
+    int err = pthread_setaffinity_np(thread, sizeof(cs), &cs);
+    if (err)
+        throw runtime_error("pthread_setaffinity_np() failed");
+#endif
+}
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// CPU topology and thread pinning
+
+
+int read_int_from_file(const string &filename)
+{
+    FILE *fp = fopen(filename.c_str(), "r");
+    if (!fp)
+	return -1;
+
+    int ret = -1;
+    if (fscanf(fp, "%d", &ret) != 1)
+	ret = -1;
+
+    fclose(fp);
+    return ret;
+}
+
+
+// Parses a cpu list of the form "0-3,8,10-11", as found in /sys.
+static vector<int> parse_cpu_list(const string &s)
+{
+    vector<int> ret;
+    const char *p = s.c_str();
+
+    while (*p) {
+	char *end = nullptr;
+	long lo = strtol(p, &end, 10);
+	if (end == p)
+	    break;
+
+	long hi = lo;
+	p = end;
+
+	if (*p == '-') {
+	    hi = strtol(p+1, &end, 10);
+	    p = end;
+	}
+
+	for (long i = lo; i <= hi; i++)
+	    ret.push_back(i);
+
+	if (*p == ',')
+	    p++;
+	else
+	    break;
+    }
+
+    return ret;
+}
+
+
+static vector<int> get_allowed_cpus()
+{
+    vector<int> ret;
+
+#ifndef __APPLE__
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+
+    if (sched_getaffinity(0, sizeof(cs), &cs) == 0) {
+	for (int i = 0; i < CPU_SETSIZE; i++)
+	    if (CPU_ISSET(i, &cs))
+		ret.push_back(i);
+    }
+#endif
+
+    if (ret.size() == 0) {
+	int n = std::thread::hardware_concurrency();
+	for (int i = 0; i < max(n,1); i++)
+	    ret.push_back(i);
+    }
+
+    return ret;
+}
+
+
+// Fills l1d_nbytes/l2_nbytes/l3_nbytes, from /sys/devices/system/cpu/cpuN/cache/indexM.
+static void read_cache_sizes(cpu_topology &topo, int cpu)
+{
+    for (int index = 0; ; index++) {
+	string dir = "/sys/devices/system/cpu/cpu" + to_string(cpu) + "/cache/index" + to_string(index) + "/";
+	FILE *fp = fopen((dir + "size").c_str(), "r");
+	if (!fp)
+	    return;
+
+	// Size is a string such as "48K" or "32M".
+	long size = 0;
+	char suffix = 0;
+	int n = fscanf(fp, "%ld%c", &size, &suffix);
+	fclose(fp);
+
+	if (n < 1)
+	    continue;
+	if (suffix == 'K')
+	    size <<= 10;
+	else if (suffix == 'M')
+	    size <<= 20;
+	else if (suffix == 'G')
+	    size <<= 30;
+
+	char type[64];
+	fp = fopen((dir + "type").c_str(), "r");
+	bool is_data = fp && (fscanf(fp, "%63s", type) == 1) && (string(type) != "Instruction");
+	if (fp)
+	    fclose(fp);
+
+	int level = read_int_from_file(dir + "level");
+	if (!is_data)
+	    continue;
+
+	if (level == 1)
+	    topo.l1d_nbytes = size;
+	else if (level == 2)
+	    topo.l2_nbytes = size;
+	else if (level == 3)
+	    topo.l3_nbytes = size;
+    }
+}
+
+
+static cpu_topology read_cpu_topology()
+{
+    cpu_topology ret;
+    vector<int> allowed = get_allowed_cpus();
+
+    // cpu -> node, from /sys/devices/system/node/nodeN/cpulist
+    vector<int> cpu_to_node(CPU_SETSIZE, 0);
+
+    DIR *dir = opendir("/sys/devices/system/node");
+    struct dirent *entry;
+
+    while (dir && (entry = readdir(dir))) {
+	int node = -1;
+	if ((sscanf(entry->d_name, "node%d", &node) != 1) || (node < 0))
+	    continue;
+
+	string filename = "/sys/devices/system/node/" + string(entry->d_name) + "/cpulist";
+	FILE *fp = fopen(filename.c_str(), "r");
+	if (!fp)
+	    continue;
+
+	char line[4096];
+	string cpulist = fgets(line, sizeof(line), fp) ? line : "";
+	fclose(fp);
+
+	for (int cpu: parse_cpu_list(cpulist))
+	    if ((cpu >= 0) && (cpu < CPU_SETSIZE))
+		cpu_to_node[cpu] = node;
+    }
+
+    if (dir)
+	closedir(dir);
+
+    for (int cpu: allowed) {
+	string dir = "/sys/devices/system/cpu/cpu" + to_string(cpu) + "/topology/";
+
+	cpu_info c;
+	c.cpu = cpu;
+	c.package = read_int_from_file(dir + "physical_package_id");
+	c.core = read_int_from_file(dir + "core_id");
+	c.node = cpu_to_node[cpu];
+
+	// Fallback if /sys is unavailable: every cpu is a separate core.
+	if ((c.package < 0) || (c.core < 0)) {
+	    c.package = 0;
+	    c.core = cpu;
+	}
+
+	ret.cpus.push_back(c);
+    }
+
+    vector<pair<int,int>> cores;
+    vector<int> packages, nodes;
+
+    for (const cpu_info &c: ret.cpus) {
+	cores.push_back({ c.package, c.core });
+	packages.push_back(c.package);
+	nodes.push_back(c.node);
+    }
+
+    for (auto *v: { &packages, &nodes }) {
+	std::sort(v->begin(), v->end());
+	v->erase(std::unique(v->begin(), v->end()), v->end());
+    }
+
+    std::sort(cores.begin(), cores.end());
+    cores.erase(std::unique(cores.begin(), cores.end()), cores.end());
+
+    ret.npackages = packages.size();
+    ret.nphysical_cores = cores.size();
+    ret.nnodes = nodes.size();
+
+    if (ret.cpus.size() > 0)
+	read_cache_sizes(ret, ret.cpus[0].cpu);
+
+    return ret;
+}
+
+
+const cpu_topology &get_cpu_topology()
+{
+    static cpu_topology ret = read_cpu_topology();
+    return ret;
+}
+
+
+const char *cpu_topology::memory_level(ssize_t nbytes_per_thread, ssize_t nbytes_total) const
+{
+    if (l1d_nbytes <= 0)
+	return "unknown";
+    if (nbytes_per_thread <= l1d_nbytes)
+	return "L1";
+    if (nbytes_per_thread <= l2_nbytes)
+	return "L2";
+    if (nbytes_total <= l3_nbytes * max(npackages,1))
+	return "L3";
+    return "DRAM";
+}
+
+
+void cpu_topology::print(ostream &os) const
+{
+    os << "cpu topology: " << cpus.size() << " cpus, " << nphysical_cores << " physical cores, "
+       << npackages << " packages, " << nnodes << " NUMA nodes" << endl;
+
+    if (l1d_nbytes > 0)
+	os << "    caches: L1d " << (l1d_nbytes >> 10) << " KiB, L2 " << (l2_nbytes >> 10)
+	   << " KiB, L3 " << (l3_nbytes >> 10) << " KiB" << endl;
+
+    for (const cpu_info &c: cpus)
+	os << "    cpu " << c.cpu << ": package " << c.package << ", core " << c.core << ", node " << c.node << endl;
+}
+
+
+const char *pinning_policy_name(pinning_policy p)
+{
+    switch (p) {
+	case PIN_SEQUENTIAL: return "sequential";
+	case PIN_COMPACT: return "compact";
+	case PIN_SCATTER: return "scatter";
+	case PIN_PHYSICAL_CORES: return "physical_cores";
+	case PIN_EXPLICIT: return "explicit";
+    }
+    throw runtime_error("pinning_policy_name(): invalid pinning_policy");
+}
+
+
+pinning_policy pinning_policy_from_string(const string &s)
+{
+    for (pinning_policy p: { PIN_SEQUENTIAL, PIN_COMPACT, PIN_SCATTER, PIN_PHYSICAL_CORES, PIN_EXPLICIT })
+	if (s == pinning_policy_name(p))
+	    return p;
+
+    throw runtime_error("unrecognized pinning policy '" + s + "' (expected one of: sequential, compact, scatter, physical_cores, explicit)");
+}
+
+
+vector<int> get_pinning(pinning_policy policy, int nthreads, const vector<int> &explicit_cpus)
+{
+    const cpu_topology &topo = get_cpu_topology();
+    vector<cpu_info> cpus = topo.cpus;
+    vector<int> order;
+
+    if (nthreads <= 0)
+	throw runtime_error("get_pinning(): nthreads must be > 0");
+    if ((policy != PIN_EXPLICIT) && (explicit_cpus.size() > 0))
+	throw runtime_error("get_pinning(): 'explicit_cpus' was specified, but pinning policy is not PIN_EXPLICIT");
+
+    // Sort key (package, core, cpu): SMT siblings are adjacent.
+    auto by_package_core = [](const cpu_info &a, const cpu_info &b)
+    {
+	return std::make_tuple(a.package, a.core, a.cpu) < std::make_tuple(b.package, b.core, b.cpu);
+    };
+
+    if (policy == PIN_SEQUENTIAL) {
+	for (const cpu_info &c: cpus)
+	    order.push_back(c.cpu);
+    }
+    else if ((policy == PIN_COMPACT) || (policy == PIN_PHYSICAL_CORES)) {
+	std::sort(cpus.begin(), cpus.end(), by_package_core);
+
+	for (size_t i = 0; i < cpus.size(); i++) {
+	    bool first_sibling = (i == 0) || (cpus[i].package != cpus[i-1].package) || (cpus[i].core != cpus[i-1].core);
+	    if ((policy == PIN_COMPACT) || first_sibling)
+		order.push_back(cpus[i].cpu);
+	}
+    }
+    else if (policy == PIN_SCATTER) {
+	// Rank each cpu by its SMT index within its core (0 = first sibling), then by its
+	// physical core index within its package.  Then deal out cpus round-robin over packages.
+	std::sort(cpus.begin(), cpus.end(), by_package_core);
+
+	vector<tuple<int,int,int,int>> keys;    // (smt_index, core_index, package, cpu)
+	int smt_index = 0, core_index = 0;
+
+	for (size_t i = 0; i < cpus.size(); i++) {
+	    bool new_package = (i == 0) || (cpus[i].package != cpus[i-1].package);
+	    bool new_core = new_package || (cpus[i].core != cpus[i-1].core);
+
+	    if (new_package)
+		core_index = 0;
+	    else if (new_core)
+		core_index++;
+
+	    smt_index = new_core ? 0 : (smt_index + 1);
+	    keys.push_back(std::make_tuple(smt_index, core_index, cpus[i].package, cpus[i].cpu));
+	}
+
+	std::sort(keys.begin(), keys.end());
+
+	for (const auto &k: keys)
+	    order.push_back(std::get<3> (k));
+    }
+    else if (policy == PIN_EXPLICIT) {
+	if ((int)explicit_cpus.size() < nthreads)
+	    throw runtime_error("get_pinning(): PIN_EXPLICIT with " + to_string(explicit_cpus.size()) + " cpus, but nthreads=" + to_string(nthreads));
+
+	for (int cpu: explicit_cpus) {
+	    bool allowed = false;
+	    for (const cpu_info &c: cpus)
+		allowed = allowed || (c.cpu == cpu);
+	    if (!allowed)
+		throw runtime_error("get_pinning(): cpu " + to_string(cpu) + " is not in the process affinity mask");
+	}
+
+	order = explicit_cpus;
+    }
+    else
+	throw runtime_error("get_pinning(): invalid pinning_policy");
+
+    if ((policy == PIN_PHYSICAL_CORES) && ((int)order.size() < nthreads))
+	throw runtime_error("get_pinning(): PIN_PHYSICAL_CORES with nthreads=" + to_string(nthreads) + ", but only " + to_string(order.size()) + " physical cores are available");
+
+    vector<int> ret(nthreads);
+    for (int i = 0; i < nthreads; i++)
+	ret[i] = order[i % order.size()];
+
+    return ret;
+}
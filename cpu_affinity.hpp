@@ -0,0 +1,84 @@
+#ifndef _CPU_AFFINITY_HPP
+#define _CPU_AFFINITY_HPP
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <sys/types.h>
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// Thread pinning and CPU topology.  These live in their own file (rather than timing_thread.hpp) so
+// that low-level code such as parallel_first_touch() can pin threads without linking timing_thread.
+
+
+// Pins the calling thread to a single core (no-op with a warning on osx).
+extern void pin_current_thread_to_core(int core_id);
+
+
+// One logical cpu.  'core' is the physical core index within its package (from /sys), so
+// SMT siblings are cpus with the same (package, core).
+struct cpu_info {
+    int cpu = 0;
+    int package = 0;
+    int core = 0;
+    int node = 0;
+};
+
+struct cpu_topology {
+    // Only cpus in the process's affinity mask (which reflects the cgroup cpuset), sorted by cpu.
+    std::vector<cpu_info> cpus;
+
+    int npackages = 0;
+    int nphysical_cores = 0;    // distinct (package, core) pairs
+    int nnodes = 0;
+
+    // Data cache sizes seen by the first allowed cpu (one cache instance, e.g. per-core L2 or
+    // per-package L3), from /sys/devices/system/cpu/cpuN/cache.  Zero if unavailable.
+    ssize_t l1d_nbytes = 0;
+    ssize_t l2_nbytes = 0;
+    ssize_t l3_nbytes = 0;
+
+    // Smallest level of the memory hierarchy ("L1", "L2", "L3" or "DRAM") which holds a working set,
+    // assuming one thread per core and an L3 per package.  Returns "unknown" if cache sizes are unavailable.
+    const char *memory_level(ssize_t nbytes_per_thread, ssize_t nbytes_total) const;
+
+    void print(std::ostream &os=std::cout) const;
+};
+
+// Reads topology from /sys/devices/system (Linux).  If unavailable, each cpu is treated as a
+// separate physical core on a single package/node.  Thread-safe; the result is computed once.
+extern const cpu_topology &get_cpu_topology();
+
+
+// How threads are assigned to cpus.  All policies only use cpus in the process affinity mask.
+//
+//   PIN_SEQUENTIAL      thread i -> i-th allowed cpu (the historical behavior: thread N -> core N).
+//   PIN_COMPACT         fill SMT siblings of one core, then the next core, then the next package.
+//   PIN_SCATTER         round-robin across packages; within a package, physical cores before SMT siblings.
+//   PIN_PHYSICAL_CORES  one thread per physical core (first SMT sibling), package by package.
+//   PIN_EXPLICIT        caller-supplied list of cpus.
+//
+// If there are more threads than cpus, PIN_SEQUENTIAL/COMPACT/SCATTER wrap around (oversubscribe),
+// and PIN_PHYSICAL_CORES/PIN_EXPLICIT throw an exception.
+enum pinning_policy {
+    PIN_SEQUENTIAL = 0,
+    PIN_COMPACT = 1,
+    PIN_SCATTER = 2,
+    PIN_PHYSICAL_CORES = 3,
+    PIN_EXPLICIT = 4
+};
+
+extern const char *pinning_policy_name(pinning_policy p);
+extern pinning_policy pinning_policy_from_string(const std::string &s);   // accepts names from pinning_policy_name()
+
+// Returns a length-nthreads vector of cpus.  The 'explicit_cpus' argument is only used for PIN_EXPLICIT.
+extern std::vector<int> get_pinning(pinning_policy policy, int nthreads, const std::vector<int> &explicit_cpus=std::vector<int>());
+
+// Reads one integer from a file such as /sys/devices/system/cpu/cpu0/topology/core_id.
+// Returns -1 if the file can't be read.
+extern int read_int_from_file(const std::string &filename);
+
+
+#endif  // _CPU_AFFINITY_HPP
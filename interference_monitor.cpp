@@ -0,0 +1,162 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "interference_monitor.hpp"
+#include "time.hpp"
+
+using namespace std;
+
+
+static int64_t read_int64_from_file(const string &filename)
+{
+    FILE *fp = fopen(filename.c_str(), "r");
+    if (!fp)
+	return 0;
+
+    long long ret = 0;
+    if (fscanf(fp, "%lld", &ret) != 1)
+	ret = 0;
+
+    fclose(fp);
+    return ret;
+}
+
+
+// Sum over all rows of /proc/interrupts, in the column for 'cpu'.
+static int64_t read_interrupt_count(int cpu)
+{
+    FILE *fp = fopen("/proc/interrupts", "r");
+    if (!fp)
+	return 0;
+
+    char *line = NULL;
+    size_t len = 0;
+    int64_t ret = 0;
+    int col = -1;
+
+    // Header line is a list of online cpus, e.g. "CPU0 CPU1 CPU4".
+    if (getline(&line, &len, fp) > 0) {
+	stringstream ss(line);
+	string s;
+	for (int i = 0; ss >> s; i++)
+	    if (s == "CPU" + to_string(cpu))
+		col = i;
+    }
+
+    while ((col >= 0) && (getline(&line, &len, fp) > 0)) {
+	char *p = strchr(line, ':');
+	if (!p)
+	    continue;
+
+	p++;
+	for (int i = 0; i <= col; i++) {
+	    char *end = NULL;
+	    long long n = strtoll(p, &end, 10);
+	    if (end == p)
+		break;     // rows such as "ERR:" have fewer columns
+	    if (i == col)
+		ret += n;
+	    p = end;
+	}
+    }
+
+    free(line);
+    fclose(fp);
+    return ret;
+}
+
+
+interference_snapshot take_interference_snapshot()
+{
+    interference_snapshot s;
+
+#ifdef __linux__
+    s.cpu = sched_getcpu();
+
+    if (s.cpu >= 0) {
+	string dir = "/sys/devices/system/cpu/cpu" + to_string(s.cpu) + "/";
+	s.freq_ghz = read_int64_from_file(dir + "cpufreq/scaling_cur_freq") / 1.0e6;   // kHz -> GHz
+	s.throttle_count = read_int64_from_file(dir + "thermal_throttle/core_throttle_count")
+	    + read_int64_from_file(dir + "thermal_throttle/package_throttle_count");
+	s.interrupts = read_interrupt_count(s.cpu);
+    }
+#endif
+
+#ifdef RUSAGE_THREAD
+    struct rusage r;
+    if (getrusage(RUSAGE_THREAD, &r) == 0) {
+	s.voluntary_csw = r.ru_nvcsw;
+	s.involuntary_csw = r.ru_nivcsw;
+    }
+#endif
+
+    s.time_ns = get_monotonic_ns();
+    return s;
+}
+
+
+// Interrupt rate check (see interference_thresholds).
+static bool too_many_interrupts(int64_t interrupts, double irq_rate, const interference_thresholds &t)
+{
+    return (t.max_interrupts_per_sec >= 0.0) && (interrupts >= t.min_interrupts) && (irq_rate > t.max_interrupts_per_sec);
+}
+
+
+interference_report compare_interference_snapshots(const interference_snapshot &start, const interference_snapshot &end, const interference_thresholds &t)
+{
+    interference_report r;
+    r.cpu = end.cpu;
+    r.migrated = (start.cpu != end.cpu);
+    r.seconds = (end.time_ns - start.time_ns) * 1.0e-9;
+    r.freq_start_ghz = start.freq_ghz;
+    r.freq_end_ghz = end.freq_ghz;
+    r.throttle_events = end.throttle_count - start.throttle_count;
+    r.interrupts = r.migrated ? 0 : (end.interrupts - start.interrupts);
+    r.voluntary_csw = end.voluntary_csw - start.voluntary_csw;
+    r.involuntary_csw = end.involuntary_csw - start.involuntary_csw;
+
+    double fmax = max(r.freq_start_ghz, r.freq_end_ghz);
+    double df = (fmax > 0.0) ? (fabs(r.freq_end_ghz - r.freq_start_ghz) / fmax) : 0.0;
+    double irq_rate = (r.seconds > 0.0) ? (r.interrupts / r.seconds) : 0.0;
+
+    r.flagged = r.migrated
+	|| ((t.max_freq_change >= 0.0) && (df > t.max_freq_change))
+	|| ((t.max_throttle_events >= 0) && (r.throttle_events > t.max_throttle_events))
+	|| too_many_interrupts(r.interrupts, irq_rate, t)
+	|| ((t.max_voluntary_csw >= 0) && (r.voluntary_csw > t.max_voluntary_csw))
+	|| ((t.max_involuntary_csw >= 0) && (r.involuntary_csw > t.max_involuntary_csw));
+
+    return r;
+}
+
+
+string interference_report::describe(const interference_thresholds &t, bool all) const
+{
+    stringstream ss;
+    ss << "cpu " << cpu;
+
+    double fmax = max(freq_start_ghz, freq_end_ghz);
+    double df = (fmax > 0.0) ? (fabs(freq_end_ghz - freq_start_ghz) / fmax) : 0.0;
+    double irq_rate = (seconds > 0.0) ? (interrupts / seconds) : 0.0;
+
+    if (migrated)
+	ss << ", migrated between cpus";
+    if ((all && (fmax > 0.0)) || ((t.max_freq_change >= 0.0) && (df > t.max_freq_change)))
+	ss << ", cpufreq " << freq_start_ghz << " -> " << freq_end_ghz << " GHz";
+    if ((all && throttle_events) || ((t.max_throttle_events >= 0) && (throttle_events > t.max_throttle_events)))
+	ss << ", " << throttle_events << " thermal throttle events";
+    if ((all && interrupts) || too_many_interrupts(interrupts, irq_rate, t))
+	ss << ", " << interrupts << " interrupts (" << irq_rate << "/sec)";
+    if ((all && voluntary_csw) || ((t.max_voluntary_csw >= 0) && (voluntary_csw > t.max_voluntary_csw)))
+	ss << ", " << voluntary_csw << " voluntary context switches";
+    if ((all && involuntary_csw) || ((t.max_involuntary_csw >= 0) && (involuntary_csw > t.max_involuntary_csw)))
+	ss << ", " << involuntary_csw << " involuntary context switches";
+
+    return ss.str();
+}
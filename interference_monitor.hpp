@@ -0,0 +1,78 @@
+#ifndef _INTERFERENCE_MONITOR_HPP
+#define _INTERFERENCE_MONITOR_HPP
+
+#include <string>
+#include <stdint.h>
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// Interference monitoring: detects timed regions which were disturbed by frequency changes,
+// thermal throttling, interrupts, or preemption.
+//
+//   interference_snapshot s0 = take_interference_snapshot();   // on the thread being measured
+//   ...
+//   interference_snapshot s1 = take_interference_snapshot();
+//   interference_report r = compare_interference_snapshots(s0, s1);
+//   if (r.flagged) cout << r.describe() << endl;
+//
+// Sources (Linux; each reads as zero where unavailable, e.g. no cpufreq in a VM):
+//   - current frequency of the calling thread's cpu, /sys/devices/system/cpu/cpuN/cpufreq/scaling_cur_freq
+//   - thermal throttle event counts, /sys/devices/system/cpu/cpuN/thermal_throttle/{core,package}_throttle_count
+//   - interrupts serviced by the cpu (all sources), from its column in /proc/interrupts
+//   - voluntary/involuntary context switches of the calling thread, from getrusage(RUSAGE_THREAD)
+//
+// A snapshot costs tens of microseconds (mostly /proc/interrupts), so it should be taken outside
+// the timed interval.  timing_thread does this if 'monitor_interference' is set.
+
+
+struct interference_snapshot {
+    int cpu = -1;                 // from sched_getcpu()
+    double freq_ghz = 0.0;
+    int64_t throttle_count = 0;
+    int64_t interrupts = 0;
+    int64_t voluntary_csw = 0;
+    int64_t involuntary_csw = 0;
+    int64_t time_ns = 0;          // get_monotonic_ns()
+};
+
+extern interference_snapshot take_interference_snapshot();
+
+
+// When a region is flagged.  A negative limit disables the corresponding check.
+//
+// The interrupt rate is only checked if the region saw at least 'min_interrupts' interrupts.  Otherwise,
+// a region shorter than ~1/max_interrupts_per_sec which happens to contain a single timer tick would be
+// flagged (e.g. 1 interrupt in 100 usec is 10000/sec).
+struct interference_thresholds {
+    double max_freq_change = 0.05;          // fractional change in cpufreq between start and end
+    int64_t max_throttle_events = 0;
+    double max_interrupts_per_sec = 2000.;  // a little above typical timer tick rates
+    int64_t min_interrupts = 2;             // see above
+    int64_t max_voluntary_csw = -1;         // not checked by default (e.g. the region may sleep)
+    int64_t max_involuntary_csw = 0;        // any preemption
+};
+
+
+struct interference_report {
+    int cpu = -1;
+    bool migrated = false;        // thread changed cpus (interrupt counts are then unreliable)
+    double seconds = 0.0;
+    double freq_start_ghz = 0.0;
+    double freq_end_ghz = 0.0;
+    int64_t throttle_events = 0;
+    int64_t interrupts = 0;
+    int64_t voluntary_csw = 0;
+    int64_t involuntary_csw = 0;
+    bool flagged = false;
+
+    // E.g. "cpu 3: 12 interrupts (6000/sec), 1 involuntary context switch".  Lists only the
+    // quantities which exceeded their thresholds (or all nonzero quantities, if 'all' is true).
+    std::string describe(const interference_thresholds &t=interference_thresholds(), bool all=false) const;
+};
+
+extern interference_report compare_interference_snapshots(const interference_snapshot &start, const interference_snapshot &end,
+							  const interference_thresholds &t=interference_thresholds());
+
+
+#endif  // _INTERFERENCE_MONITOR_HPP
@@ -0,0 +1,154 @@
+// Pointer-chasing latency benchmark: measures load-to-use latency (ns per load) at each level of
+// the memory hierarchy, with and without transparent huge pages.
+//
+// Each thread builds a single random cycle through the cache lines of its working set (so that
+// hardware prefetchers can't help, and a new page is touched on almost every load once the working
+// set exceeds the TLB reach), then times a chain of dependent loads.  Running several pinned threads
+// (-t) measures loaded latency: every thread chases its own chain concurrently.  Output is CSV on stdout.
+//
+// Usage: latency-benchmark [-t nthreads] [-p pinning] [-s min_kib] [-m max_mib] [-l nloads] [-n ntrials] [-H|-N] [-u]
+//
+//   -t  number of concurrent threads (default 1)
+//   -p  pinning policy (sequential, compact, scatter, physical_cores; default sequential)
+//   -s  smallest per-thread working set, in KiB (default 4)
+//   -m  largest per-thread working set, in MiB (default 1024)
+//   -l  dependent loads per trial (default 2^20)
+//   -n  trials per working set (default 5)
+//   -H  only run with huge pages (default is to run both with and without)
+//   -N  only run without huge pages
+//   -u  don't pin threads
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+#include "argument_parser.hpp"
+#include "memory_utils.hpp"
+#include "memory_kernels.hpp"
+#include "timing_thread.hpp"
+
+using namespace std;
+
+
+class latency_thread : public timing_thread {
+public:
+    const ssize_t nbytes;
+    const bool hugepages;
+    const ssize_t nloads;
+    const int ntrials;
+
+    // Prevents the chase from being optimized out.  Not static, since every thread writes it.
+    chase_node * volatile sink = nullptr;
+
+    latency_thread(const shared_ptr<timing_thread_pool> &pool_, bool pin_to_core, bool warm_up, ssize_t nbytes_, bool hugepages_, ssize_t nloads_, int ntrials_) :
+	timing_thread(pool_, pin_to_core, warm_up), nbytes(nbytes_), hugepages(hugepages_), nloads(nloads_), ntrials(ntrials_)
+    {
+	// Timings are read back from the pool and printed as CSV by main().
+	this->verbose = false;
+	this->name = "chase";
+    }
+
+    virtual ~latency_thread() { }
+
+    virtual void thread_body() override
+    {
+	ssize_t nnodes = nbytes / sizeof(chase_node);
+
+	// Fresh mmap() pages (at least one huge page), with the huge page advice applied before the
+	// first touch.  Not zeroed, since every node is written below.
+	size_t nalloc = max(size_t(nbytes), hugepage_size);
+	char *buf = reinterpret_cast<char *> (hugepage_alloc(nalloc, hugepages ? HUGEPAGES_TRANSPARENT : HUGEPAGES_NONE));
+
+	chase_node *nodes = reinterpret_cast<chase_node *> (buf);
+	std::mt19937 rng(12345 + thread_id);
+	make_chase_cycle(nodes, nnodes, rng);
+
+	// Untimed pass, to bring the working set into cache (where it fits) and populate the page tables.
+	chase_node *p = chase(nodes, nnodes);
+
+	this->run_trials(ntrials, [&]() { p = chase(p, nloads); });
+
+	sink = p;
+	hugepage_free(buf, nalloc);
+    }
+};
+
+
+static void usage()
+{
+    cerr << "usage: latency-benchmark [-t nthreads] [-p pinning] [-s min_kib] [-m max_mib] [-l nloads] [-n ntrials] [-H|-N] [-u]" << endl;
+    exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+    const cpu_topology &topo = get_cpu_topology();
+
+    int nthreads = 1;
+    string pinning_name = "sequential";
+    long min_kib = 4;
+    long max_mib = 1024;
+    long nloads = 1 << 20;
+    int ntrials = 5;
+    bool only_hugepages = false;
+    bool no_hugepages = false;
+    bool unpinned = false;
+
+    argument_parser parser;
+    parser.add_flag_with_parameter("-t", nthreads);
+    parser.add_flag_with_parameter("-p", pinning_name);
+    parser.add_flag_with_parameter("-s", min_kib);
+    parser.add_flag_with_parameter("-m", max_mib);
+    parser.add_flag_with_parameter("-l", nloads);
+    parser.add_flag_with_parameter("-n", ntrials);
+    parser.add_boolean_flag("-H", only_hugepages);
+    parser.add_boolean_flag("-N", no_hugepages);
+    parser.add_boolean_flag("-u", unpinned);
+
+    if (!parser.parse_args(argc, argv) || (parser.nargs > 0))
+	usage();
+    if ((nthreads < 1) || (min_kib < 1) || (max_mib < 1) || (nloads < 1) || (ntrials < 1) || (only_hugepages && no_hugepages))
+	usage();
+
+    pinning_policy pinning = pinning_policy_from_string(pinning_name);
+
+    vector<bool> hugepage_modes;
+    if (!only_hugepages)
+	hugepage_modes.push_back(false);
+    if (!no_hugepages)
+	hugepage_modes.push_back(true);
+
+    // Metadata goes to stderr, so that stdout is pure CSV.
+    topo.print(cerr);
+
+    cout << "nthreads,pinning,hugepages,nbytes_per_thread,nbytes_total,level,nloads,ntrials,min_ns,median_ns" << endl;
+
+    for (bool hugepages: hugepage_modes) {
+	bool warm_up = true;
+
+	for (ssize_t nbytes = min_kib << 10; nbytes <= (max_mib << 20); nbytes *= 2) {
+	    auto pool = make_shared<timing_thread_pool> (nthreads, TIMER_MONOTONIC, BARRIER_HYBRID, pinning);
+
+	    vector<thread> threads(nthreads);
+	    for (int i = 0; i < nthreads; i++)
+		threads[i] = spawn_timing_thread<latency_thread> (pool, !unpinned, warm_up, nbytes, hugepages, nloads, ntrials);
+	    for (int i = 0; i < nthreads; i++)
+		threads[i].join();
+
+	    // Warm-up is only needed once.
+	    warm_up = false;
+
+	    timing_statistics s = compute_timing_statistics(pool->get_samples("chase"));
+	    ssize_t nbytes_total = nbytes * nthreads;
+
+	    cout << nthreads << "," << pinning_policy_name(pinning) << "," << (hugepages ? 1 : 0)
+		 << "," << nbytes << "," << nbytes_total << "," << topo.memory_level(nbytes, nbytes_total)
+		 << "," << nloads << "," << s.ntrials << "," << (s.min / nloads * 1.0e9)
+		 << "," << (s.median / nloads * 1.0e9) << endl;
+	}
+    }
+
+    return 0;
+}
@@ -0,0 +1,262 @@
+#include <cmath>
+#include <climits>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include "latency_histogram.hpp"
+
+using namespace std;
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// histogram_snapshot
+
+
+int histogram_snapshot::num_bins(int nbits)
+{
+    return (64 - nbits) << nbits;
+}
+
+
+int64_t histogram_snapshot::bin_lower_bound(int index, int nbits)
+{
+    int64_t nsub = int64_t(1) << nbits;
+    if (index < 2*nsub)
+	return index;
+
+    int shift = (index >> nbits) - 1;
+    return (nsub + (index & (nsub-1))) << shift;
+}
+
+
+int64_t histogram_snapshot::bin_width(int index, int nbits)
+{
+    int64_t nsub = int64_t(1) << nbits;
+    return (index < 2*nsub) ? 1 : (int64_t(1) << ((index >> nbits) - 1));
+}
+
+
+histogram_snapshot::histogram_snapshot(int nbits_) :
+    nbits(nbits_)
+{
+    if ((nbits < 0) || (nbits > 16))
+	throw runtime_error("histogram_snapshot: nbits=" + to_string(nbits) + " is out of range (expected 0 <= nbits <= 16)");
+
+    bins.resize(num_bins(nbits), 0);
+}
+
+
+void histogram_snapshot::record(int64_t value, int64_t n)
+{
+    if (n <= 0)
+	return;
+
+    value = std::max(value, int64_t(0));
+    min = (count > 0) ? std::min(min, value) : value;
+    max = (count > 0) ? std::max(max, value) : value;
+    count += n;
+    sum += double(value) * n;
+    bins[bin_index(value, nbits)] += n;
+}
+
+
+void histogram_snapshot::merge(const histogram_snapshot &h)
+{
+    if (h.nbits != nbits)
+	throw runtime_error("histogram_snapshot::merge(): nbits mismatch (" + to_string(nbits) + ", " + to_string(h.nbits) + ")");
+
+    if (h.count == 0)
+	return;
+
+    min = (count > 0) ? std::min(min, h.min) : h.min;
+    max = (count > 0) ? std::max(max, h.max) : h.max;
+    count += h.count;
+    sum += h.sum;
+
+    for (size_t i = 0; i < bins.size(); i++)
+	bins[i] += h.bins[i];
+}
+
+
+double histogram_snapshot::percentile(double q) const
+{
+    if (count == 0)
+	return 0.0;
+
+    // Nearest rank, as in compute_timing_statistics().
+    int64_t rank = std::max(int64_t(1), std::min(count, int64_t(ceil(q * count))));
+    int64_t n = 0;
+
+    for (size_t i = 0; i < bins.size(); i++) {
+	n += bins[i];
+	if (n < rank)
+	    continue;
+
+	double mid = bin_lower_bound(i, nbits) + 0.5 * (bin_width(i, nbits) - 1);
+	return std::max(double(min), std::min(double(max), mid));
+    }
+
+    return max;
+}
+
+
+void histogram_snapshot::print(ostream &os, const string &units, double scale) const
+{
+    string u = (units.size() > 0) ? (" " + units) : "";
+
+    os << count << " samples";
+
+    if (count > 0) {
+	os << ", min " << (scale * min) << u << ", p50 " << (scale * percentile(0.5)) << u
+	   << ", p99 " << (scale * percentile(0.99)) << u << ", p99.9 " << (scale * percentile(0.999)) << u
+	   << ", max " << (scale * max) << u << ", mean " << (scale * mean()) << u;
+    }
+
+    os << endl;
+}
+
+
+// Format:
+//   histogram_snapshot <nbits> <count> <min> <max> <sum> <nonzero_bins>
+//   <index> <count>      (one line per nonzero bin)
+void histogram_snapshot::serialize(ostream &os) const
+{
+    int nnz = 0;
+    for (int64_t b: bins)
+	nnz += (b != 0) ? 1 : 0;
+
+    auto prec = os.precision(17);
+    os << "histogram_snapshot " << nbits << " " << count << " " << min << " " << max << " " << sum << " " << nnz << "\n";
+
+    for (size_t i = 0; i < bins.size(); i++)
+	if (bins[i] != 0)
+	    os << i << " " << bins[i] << "\n";
+
+    os.flush();
+    os.precision(prec);
+}
+
+
+histogram_snapshot histogram_snapshot::deserialize(istream &is)
+{
+    string header;
+    int nbits = 0;
+    int nnz = 0;
+
+    if (!(is >> header >> nbits) || (header != "histogram_snapshot"))
+	throw runtime_error("histogram_snapshot::deserialize(): bad header");
+
+    histogram_snapshot ret(nbits);
+
+    if (!(is >> ret.count >> ret.min >> ret.max >> ret.sum >> nnz) || (nnz < 0))
+	throw runtime_error("histogram_snapshot::deserialize(): bad header");
+
+    int64_t total = 0;
+
+    for (int i = 0; i < nnz; i++) {
+	int64_t index = -1, n = 0;
+	if (!(is >> index >> n) || (index < 0) || (index >= int64_t(ret.bins.size())) || (n <= 0))
+	    throw runtime_error("histogram_snapshot::deserialize(): bad bin");
+	ret.bins[index] += n;
+	total += n;
+    }
+
+    if (total != ret.count)
+	throw runtime_error("histogram_snapshot::deserialize(): bin counts don't sum to total count");
+
+    return ret;
+}
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// latency_histogram
+
+
+latency_histogram::latency_histogram(int nshards_, int nbits_) :
+    nbits(nbits_),
+    nshards(nshards_)
+{
+    if (nshards <= 0)
+	throw runtime_error("latency_histogram constructor called with nshards <= 0");
+
+    // Checks nbits.
+    int nb = histogram_snapshot(nbits).bins.size();
+
+    for (int i = 0; i < nshards; i++) {
+	shard_t *s = new shard_t;
+	s->bins.reset(new atomic<int64_t>[nb]);
+	shards.push_back(unique_ptr<shard_t> (s));
+    }
+
+    reset();
+}
+
+
+void latency_histogram::record(int64_t value)
+{
+    // Assigned round-robin, on first call from each thread (shared by all latency_histograms).
+    static atomic<int> next_shard(0);
+    static thread_local int shard = next_shard++;
+
+    record(value, shard % nshards);
+}
+
+
+histogram_snapshot latency_histogram::snapshot() const
+{
+    histogram_snapshot ret(nbits);
+
+    for (const auto &s: shards) {
+	histogram_snapshot h(nbits);
+
+	for (size_t i = 0; i < h.bins.size(); i++) {
+	    h.bins[i] = s->bins[i].load(memory_order_relaxed);
+	    h.count += h.bins[i];
+	}
+
+	if (h.count == 0)
+	    continue;
+
+	h.sum = s->sum.load(memory_order_relaxed);
+	h.min = s->min.load(memory_order_relaxed);
+	h.max = s->max.load(memory_order_relaxed);
+
+	// A concurrent record() may have incremented a bin without (visibly) updating min/max yet.
+	// If so, we fall back to the edges of the first/last nonzero bins.
+	int ilo = 0, ihi = h.bins.size() - 1;
+	while (h.bins[ilo] == 0)
+	    ilo++;
+	while (h.bins[ihi] == 0)
+	    ihi--;
+
+	int64_t lo = histogram_snapshot::bin_lower_bound(ilo, nbits);
+	int64_t hi = histogram_snapshot::bin_lower_bound(ihi, nbits) + histogram_snapshot::bin_width(ihi, nbits) - 1;
+
+	if ((h.min < lo) || (h.min >= lo + histogram_snapshot::bin_width(ilo, nbits)))
+	    h.min = lo;
+	if ((h.max > hi) || (h.max < histogram_snapshot::bin_lower_bound(ihi, nbits)))
+	    h.max = hi;
+
+	ret.merge(h);
+    }
+
+    return ret;
+}
+
+
+void latency_histogram::reset()
+{
+    int nb = histogram_snapshot::num_bins(nbits);
+
+    for (const auto &s: shards) {
+	for (int i = 0; i < nb; i++)
+	    s->bins[i].store(0, memory_order_relaxed);
+
+	s->sum.store(0, memory_order_relaxed);
+	s->min.store(LLONG_MAX, memory_order_relaxed);
+	s->max.store(LLONG_MIN, memory_order_relaxed);
+    }
+}
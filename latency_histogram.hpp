@@ -0,0 +1,137 @@
+#ifndef _LATENCY_HISTOGRAM_HPP
+#define _LATENCY_HISTOGRAM_HPP
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// Streaming latency histograms (HDR-style): fixed memory, bounded relative error, mergeable.
+//
+//   auto h = std::make_shared<latency_histogram> (nthreads);
+//
+//   // On thread i (lock-free):
+//   h->record(dt_ns, i);
+//
+//   // At any time, on any thread:
+//   histogram_snapshot s = h->snapshot();
+//   cout << s.percentile(0.999) << endl;
+//
+//   s.serialize(f);            // text format, for offline merging:
+//   histogram_snapshot t = histogram_snapshot::deserialize(g);
+//   t.merge(s);
+//
+// Values are non-negative integers (e.g. nanoseconds).  Bins are log-linear: each power of two
+// [2^k, 2^(k+1)) is split into 2^nbits equal sub-bins (values below 2^(nbits+1) are exact), so the
+// relative error of a percentile is at most 2^(-nbits-1) (0.4% for the default nbits=7).  A histogram
+// covers the full int64 range in (64-nbits) * 2^nbits bins (58 KB per shard with nbits=7).
+//
+// latency_histogram has one shard per recording thread, so recording is a few relaxed atomic adds
+// to cache lines which (usually) no other thread writes.  Threads which don't pass a shard index
+// are assigned one round-robin, and may share a shard (which is still correct, but slower).
+
+
+// A plain (non-thread-safe) histogram: the result of latency_histogram::snapshot(), or of merging.
+struct histogram_snapshot {
+    int nbits = 7;
+    int64_t count = 0;
+    int64_t min = 0;      // exact (not binned); zero if count == 0
+    int64_t max = 0;
+    double sum = 0.0;     // exact sum of values, for the mean
+
+    std::vector<int64_t> bins;   // length num_bins(nbits)
+
+    histogram_snapshot(int nbits=7);
+
+    void record(int64_t value, int64_t n=1);
+
+    // Throws an exception if 'nbits' differs.
+    void merge(const histogram_snapshot &h);
+
+    // Nearest-rank percentile, 0 <= q <= 1 (e.g. 0.99 for p99), returned as the midpoint of the bin,
+    // clamped to [min,max].  Returns 0 if count == 0.
+    double percentile(double q) const;
+    double mean() const { return (count > 0) ? (sum / count) : 0.0; }
+
+    // E.g. "1000 samples, min 102, p50 110, p99 180, p99.9 950, max 1204, mean 115.3".  Values
+    // are multiplied by 'scale' (e.g. 1.0e-3 to print nanoseconds as microseconds).
+    void print(std::ostream &os=std::cout, const std::string &units="", double scale=1.0) const;
+
+    // Sparse text format (only nonzero bins), one snapshot per call.  deserialize() throws an
+    // exception on malformed input.
+    void serialize(std::ostream &os) const;
+    static histogram_snapshot deserialize(std::istream &is);
+
+    // Bin layout.
+    static int num_bins(int nbits);
+    static int64_t bin_lower_bound(int index, int nbits);
+    static int64_t bin_width(int index, int nbits);
+
+    // Value must be >= 0.
+    static inline int bin_index(int64_t value, int nbits)
+    {
+	int64_t nsub = int64_t(1) << nbits;
+	if (value < 2*nsub)
+	    return value;
+
+	int shift = 63 - __builtin_clzll(value) - nbits;
+	return ((shift+1) << nbits) + int((value >> shift) - nsub);
+    }
+};
+
+
+class latency_histogram {
+public:
+    const int nbits;
+    const int nshards;
+
+    latency_histogram(int nshards=1, int nbits=7);
+
+    // Lock-free.  Negative values are recorded as zero.  Shard index must be 0 <= shard < nshards.
+    inline void record(int64_t value, int shard)
+    {
+	value = (value > 0) ? value : 0;
+	shard_t &s = *shards[shard];
+
+	s.bins[histogram_snapshot::bin_index(value, nbits)].fetch_add(1, std::memory_order_relaxed);
+	s.sum.fetch_add(value, std::memory_order_relaxed);
+
+	// Usually no stores after the first few values.
+	for (int64_t m = s.min.load(std::memory_order_relaxed); value < m; )
+	    if (s.min.compare_exchange_weak(m, value, std::memory_order_relaxed))
+		break;
+	for (int64_t m = s.max.load(std::memory_order_relaxed); value > m; )
+	    if (s.max.compare_exchange_weak(m, value, std::memory_order_relaxed))
+		break;
+    }
+
+    // Uses a shard assigned to the calling thread.
+    void record(int64_t value);
+
+    // Sum over shards.  Can be called concurrently with record() (values recorded during the call
+    // may or may not be included).
+    histogram_snapshot snapshot() const;
+
+    // Not atomic with respect to concurrent record() calls.
+    void reset();
+
+protected:
+    struct shard_t {
+	char _pad0[64];
+	std::unique_ptr<std::atomic<int64_t>[]> bins;
+	std::atomic<int64_t> sum;
+	std::atomic<int64_t> min;
+	std::atomic<int64_t> max;
+	char _pad1[64];
+    };
+
+    std::vector<std::unique_ptr<shard_t>> shards;
+};
+
+
+#endif  // _LATENCY_HISTOGRAM_HPP
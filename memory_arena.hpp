@@ -0,0 +1,140 @@
+#ifndef _MEMORY_ARENA_HPP
+#define _MEMORY_ARENA_HPP
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+
+#include "memory_utils.hpp"
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// memory_arena: a bump allocator for per-iteration scratch memory.  One large region is allocated
+// up front with aligned_alloc(), and sub-allocations are carved out of it by advancing an offset.
+// Nothing is freed individually; instead the caller records a mark and resets to it later:
+//
+//   memory_arena arena(100 * 1024 * 1024);
+//
+//   for (int iter = 0; iter < niter; iter++) {
+//       size_t m = arena.mark();
+//       float *a = arena.alloc<float> (n);
+//       float *b = arena.alloc<float> (n, 128, true);   // 128-byte aligned, zeroed
+//       ...
+//       arena.reset(m);                                 // frees a and b
+//   }
+//
+// Exceeding the arena's capacity throws an exception.  If 'debug' is true, each sub-allocation is
+// followed by a guard region filled with a fixed byte pattern.  Guards are checked in reset() (for
+// the allocations being released) and in check_guards(), and an exception is thrown if a guard has
+// been overwritten (i.e. some caller wrote past the end of its array).
+//
+// Not thread-safe: use one arena per thread.
+
+
+class memory_arena {
+public:
+    const size_t capacity;
+    const bool debug;
+
+    static constexpr size_t guard_nbytes = 64;
+    static constexpr unsigned char guard_byte = 0xfd;
+
+    memory_arena(size_t capacity_, bool debug_=false, size_t nalign=4096) :
+	capacity(capacity_), debug(debug_), base(make_uptr<char> (capacity_, nalign, false))
+    {
+	if (capacity == 0)
+	    throw std::runtime_error("memory_arena constructor called with capacity=0");
+    }
+
+    // Noncopyable
+    memory_arena(const memory_arena &) = delete;
+    memory_arena &operator=(const memory_arena &) = delete;
+
+    template<typename T>
+    inline T *alloc(size_t nelts, size_t nalign=64, bool zero=false)
+    {
+	char *p = _alloc(nelts * sizeof(T), nalign);
+	if (zero)
+	    memset(p, 0, nelts * sizeof(T));
+	return reinterpret_cast<T *> (p);
+    }
+
+    inline size_t mark() const { return curr; }
+
+    inline void reset(size_t m=0)
+    {
+	if (m > curr)
+	    throw std::runtime_error("memory_arena::reset(): mark is past the current allocation offset");
+
+	while ((guards.size() > 0) && (guards.back() >= m)) {
+	    _check_guard(guards.back());
+	    guards.pop_back();
+	}
+
+	this->curr = m;
+    }
+
+    inline void check_guards() const
+    {
+	for (size_t g: guards)
+	    _check_guard(g);
+    }
+
+    inline size_t nbytes_used() const { return curr; }
+    inline size_t peak_nbytes_used() const { return peak; }
+    inline ssize_t num_allocs() const { return nalloc; }
+
+    inline void print_usage(std::ostream &os=std::cout, const std::string &name="memory_arena") const
+    {
+	os << name << ": peak usage " << peak << " / " << capacity << " bytes ("
+	   << (100.0 * peak / capacity) << "%), current usage " << curr << " bytes, "
+	   << nalloc << " allocations" << std::endl;
+    }
+
+protected:
+    uptr<char> base;
+    size_t curr = 0;
+    size_t peak = 0;
+    ssize_t nalloc = 0;
+
+    // Offsets of guard regions (debug mode only), in increasing order.
+    std::vector<size_t> guards;
+
+    inline char *_alloc(size_t nbytes, size_t nalign)
+    {
+	if ((nalign == 0) || (nalign & (nalign-1)))
+	    throw std::runtime_error("memory_arena::alloc(): alignment must be a power of two");
+
+	uintptr_t b = uintptr_t(base.get());
+	size_t offset = ((b + curr + nalign - 1) & ~uintptr_t(nalign-1)) - b;
+	size_t extra = debug ? guard_nbytes : 0;
+
+	if ((offset > capacity) || (nbytes > capacity - offset) || (extra > capacity - offset - nbytes))
+	    throw std::runtime_error("memory_arena: capacity (" + std::to_string(capacity) + " bytes) exceeded");
+
+	if (debug) {
+	    memset(base.get() + offset + nbytes, guard_byte, guard_nbytes);
+	    guards.push_back(offset + nbytes);
+	}
+
+	this->curr = offset + nbytes + extra;
+	this->peak = std::max(peak, curr);
+	this->nalloc++;
+
+	return base.get() + offset;
+    }
+
+    inline void _check_guard(size_t g) const
+    {
+	const unsigned char *p = reinterpret_cast<const unsigned char *> (base.get() + g);
+
+	for (size_t i = 0; i < guard_nbytes; i++)
+	    if (p[i] != guard_byte)
+		throw std::runtime_error("memory_arena: guard region at offset " + std::to_string(g) + " was overwritten (array overflow?)");
+    }
+};
+
+
+#endif  // _MEMORY_ARENA_HPP
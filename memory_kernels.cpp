@@ -0,0 +1,98 @@
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "memory_kernels.hpp"
+#include "random.hpp"
+
+using namespace std;
+
+
+const char *stream_kernel_names[STREAM_NKERNELS] = { "copy", "scale", "add", "triad", "read", "write" };
+const int stream_kernel_narrays[STREAM_NKERNELS] = { 2, 2, 3, 3, 1, 1 };
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// STREAM kernels
+
+
+__attribute__((noinline)) void stream_copy(double *__restrict__ c, const double *__restrict__ a, ssize_t n)
+{
+    for (ssize_t i = 0; i < n; i++)
+	c[i] = a[i];
+}
+
+__attribute__((noinline)) void stream_scale(double *__restrict__ b, const double *__restrict__ c, double s, ssize_t n)
+{
+    for (ssize_t i = 0; i < n; i++)
+	b[i] = s * c[i];
+}
+
+__attribute__((noinline)) void stream_add(double *__restrict__ c, const double *__restrict__ a, const double *__restrict__ b, ssize_t n)
+{
+    for (ssize_t i = 0; i < n; i++)
+	c[i] = a[i] + b[i];
+}
+
+__attribute__((noinline)) void stream_triad(double *__restrict__ a, const double *__restrict__ b, const double *__restrict__ c, double s, ssize_t n)
+{
+    for (ssize_t i = 0; i < n; i++)
+	a[i] = b[i] + s * c[i];
+}
+
+__attribute__((noinline)) double stream_read(const double *__restrict__ a, ssize_t n)
+{
+    double sum = 0.0;
+    for (ssize_t i = 0; i < n; i++)
+	sum += a[i];
+    return sum;
+}
+
+__attribute__((noinline)) void stream_write(double *__restrict__ a, double s, ssize_t n)
+{
+    for (ssize_t i = 0; i < n; i++)
+	a[i] = s;
+}
+
+
+double run_stream_kernel(int k, double *a, double *b, double *c, double s, ssize_t n)
+{
+    switch (k) {
+	case STREAM_COPY: stream_copy(c, a, n); return 0.0;
+	case STREAM_SCALE: stream_scale(b, c, s, n); return 0.0;
+	case STREAM_ADD: stream_add(c, a, b, n); return 0.0;
+	case STREAM_TRIAD: stream_triad(a, b, c, s, n); return 0.0;
+	case STREAM_READ: return stream_read(a, n);
+	case STREAM_WRITE: stream_write(a, s, n); return 0.0;
+    }
+
+    throw runtime_error("run_stream_kernel(): invalid kernel " + to_string(k));
+}
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// Pointer chasing
+
+
+void make_chase_cycle(chase_node *nodes, ssize_t nnodes, std::mt19937 &rng)
+{
+    // Random cyclic permutation: node perm[i] points to node perm[i+1].
+    vector<ssize_t> perm(nnodes);
+    for (ssize_t i = 0; i < nnodes; i++)
+	perm[i] = i;
+
+    randomly_permute(rng, perm);
+
+    for (ssize_t i = 0; i < nnodes; i++)
+	nodes[perm[i]].next = &nodes[perm[(i+1) % nnodes]];
+}
+
+
+__attribute__((noinline)) chase_node *chase(chase_node *p, ssize_t nloads)
+{
+    for (ssize_t i = 0; i < nloads; i++)
+	p = p->next;
+    return p;
+}
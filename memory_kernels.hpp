@@ -0,0 +1,54 @@
+#ifndef _MEMORY_KERNELS_HPP
+#define _MEMORY_KERNELS_HPP
+
+#include <random>
+#include <sys/types.h>
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// Memory benchmark kernels, shared by stream-benchmark, latency-benchmark, and the memory/stream and
+// memory/latency benchmarks in run-benchmarks (suite_benchmarks.cpp), so that they all time the same code.
+//
+// The kernels are compiled in their own translation unit (memory_kernels.cpp), so that the compiler
+// can't merge or elide repeated passes.
+
+
+enum stream_kernel {
+    STREAM_COPY = 0,      // c = a
+    STREAM_SCALE = 1,     // b = s*c
+    STREAM_ADD = 2,       // c = a + b
+    STREAM_TRIAD = 3,     // a = b + s*c
+    STREAM_READ = 4,      // sum += a
+    STREAM_WRITE = 5,     // a = s
+    STREAM_NKERNELS = 6
+};
+
+extern const char *stream_kernel_names[STREAM_NKERNELS];   // "copy", "scale", ...
+extern const int stream_kernel_narrays[STREAM_NKERNELS];   // arrays accessed (for STREAM byte counts)
+
+extern void stream_copy(double *__restrict__ c, const double *__restrict__ a, ssize_t n);
+extern void stream_scale(double *__restrict__ b, const double *__restrict__ c, double s, ssize_t n);
+extern void stream_add(double *__restrict__ c, const double *__restrict__ a, const double *__restrict__ b, ssize_t n);
+extern void stream_triad(double *__restrict__ a, const double *__restrict__ b, const double *__restrict__ c, double s, ssize_t n);
+extern double stream_read(const double *__restrict__ a, ssize_t n);
+extern void stream_write(double *__restrict__ a, double s, ssize_t n);
+
+// Runs one pass of kernel 'k' on length-n arrays a, b, c.  Returns the sum for STREAM_READ, otherwise zero.
+extern double run_stream_kernel(int k, double *a, double *b, double *c, double s, ssize_t n);
+
+
+// Pointer chasing: one node per cache line, so that every load in the chain is to a different line.
+struct chase_node {
+    chase_node *next;
+    char _pad[64 - sizeof(chase_node *)];
+};
+
+// Links nodes[0:nnodes] into a single random cycle (so that hardware prefetchers can't help).
+extern void make_chase_cycle(chase_node *nodes, ssize_t nnodes, std::mt19937 &rng);
+
+// Follows 'nloads' dependent loads, starting at p.
+extern chase_node *chase(chase_node *p, ssize_t nloads);
+
+
+#endif  // _MEMORY_KERNELS_HPP
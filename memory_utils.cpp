@@ -0,0 +1,456 @@
+#include <cmath>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <exception>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+#include "memory_utils.hpp"
+#include "cpu_affinity.hpp"
+
+using namespace std;
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// parallel_first_touch()
+
+
+// Touches bytes [lo,hi) of 'p'.  If 'zero' is false, we read and write back one byte per page,
+// which faults the page in for writing without changing its contents.
+static void _touch_range(char *p, size_t lo, size_t hi, size_t pagesize, bool zero)
+{
+    if (lo >= hi)
+	return;
+
+    if (zero) {
+	memset(p + lo, 0, hi - lo);
+	return;
+    }
+
+    volatile char *q = p;
+    size_t i = lo;
+
+    while (i < hi) {
+	q[i] = q[i];
+	i += pagesize - ((uintptr_t(p) + i) % pagesize);
+    }
+}
+
+
+// Sets a "preferred node" memory policy on the page-aligned interior of [p, p+nbytes), where the node
+// is the NUMA node of the calling thread.  Returns false if this isn't supported.
+static bool _mbind_local(char *p, size_t nbytes, size_t pagesize)
+{
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_getcpu)
+    unsigned int cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0)
+	return false;
+
+    const int nbits = 8 * sizeof(unsigned long);
+    if (node >= (unsigned int) (4 * nbits))
+	return false;
+
+    unsigned long nodemask[4] = { 0, 0, 0, 0 };
+    nodemask[node / nbits] = 1UL << (node % nbits);
+
+    uintptr_t lo = ((uintptr_t(p) + pagesize - 1) / pagesize) * pagesize;
+    uintptr_t hi = ((uintptr_t(p) + nbytes) / pagesize) * pagesize;
+
+    if (lo >= hi)
+	return true;
+
+    return syscall(SYS_mbind, lo, hi - lo, MPOL_PREFERRED, nodemask, 4 * nbits, 0) == 0;
+#else
+    return false;
+#endif
+}
+
+
+void parallel_first_touch(void *p_, size_t nbytes, const vector<int> &cores, numa_policy policy, bool zero)
+{
+    char *p = reinterpret_cast<char *> (p_);
+    size_t nthreads = cores.size();
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+
+    if (!p || (nbytes == 0))
+	return;
+    if ((policy != NUMA_LOCAL) && (policy != NUMA_INTERLEAVE) && (policy != NUMA_BLOCKED))
+	throw runtime_error("parallel_first_touch(): invalid numa_policy");
+
+    if (nthreads == 0) {
+	_touch_range(p, 0, nbytes, pagesize, zero);
+	return;
+    }
+
+    if ((policy == NUMA_LOCAL) && !_mbind_local(p, nbytes, pagesize)) {
+	// Without mbind(), the only way to get local placement is to touch from the calling thread.
+	_touch_range(p, 0, nbytes, pagesize, zero);
+	return;
+    }
+
+    // Page k covers bytes [k*pagesize - offset, (k+1)*pagesize - offset), clipped to [0,nbytes).
+    size_t offset = uintptr_t(p) % pagesize;
+    size_t npages = (offset + nbytes + pagesize - 1) / pagesize;
+
+    auto page_lo = [=](size_t k) { return min(nbytes, (k > 0) ? (k * pagesize - offset) : 0); };
+
+    auto worker = [=](size_t ithread)
+    {
+	pin_current_thread_to_core(cores[ithread]);
+
+	if (policy == NUMA_INTERLEAVE) {
+	    for (size_t k = ithread; k < npages; k += nthreads)
+		_touch_range(p, page_lo(k), page_lo(k+1), pagesize, zero);
+	}
+	else {
+	    // NUMA_BLOCKED or NUMA_LOCAL (in the latter case, placement was already decided by mbind()).
+	    size_t k0 = (ithread * npages) / nthreads;
+	    size_t k1 = ((ithread+1) * npages) / nthreads;
+	    _touch_range(p, page_lo(k0), page_lo(k1), pagesize, zero);
+	}
+    };
+
+    // Exceptions (e.g. a bad core_id) are propagated to the caller after all threads are joined.
+    vector<thread> threads(nthreads);
+    vector<exception_ptr> errors(nthreads);
+
+    for (size_t i = 0; i < nthreads; i++) {
+	threads[i] = thread([&worker,&errors,i]() {
+	    try {
+		worker(i);
+	    } catch (...) {
+		errors[i] = current_exception();
+	    }
+	});
+    }
+
+    for (size_t i = 0; i < nthreads; i++)
+	threads[i].join();
+
+    for (size_t i = 0; i < nthreads; i++)
+	if (errors[i])
+	    rethrow_exception(errors[i]);
+}
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// Allocation accounting
+
+
+static const int max_memory_tags = 256;
+
+// Per-thread counters.  Each counter is only written by its owning thread (with a relaxed load/store
+// pair, not a read-modify-write), and read by get_memory_accounting_stats().
+struct thread_memory_counters {
+    std::atomic<ssize_t> nalloc[max_memory_tags];
+    std::atomic<ssize_t> nfree[max_memory_tags];
+    std::atomic<ssize_t> nbytes_alloc[max_memory_tags];
+    std::atomic<ssize_t> nbytes_free[max_memory_tags];
+
+    thread_memory_counters()
+    {
+	for (int i = 0; i < max_memory_tags; i++) {
+	    nalloc[i].store(0);
+	    nfree[i].store(0);
+	    nbytes_alloc[i].store(0);
+	    nbytes_free[i].store(0);
+	}
+    }
+};
+
+
+// Global state.  When a thread exits, its counters are added into the 'retired_*' totals and freed
+// (see thread_counters_holder below), so that memory use and report cost don't grow with the number of
+// threads ever created.  We use function-local statics so that allocations from static constructors in
+// other files work.
+
+struct memory_accounting_state {
+    std::mutex lock;
+    std::vector<std::string> tag_names;
+    std::vector<std::unique_ptr<thread_memory_counters>> all_counters;   // live threads only
+
+    // Counts from exited threads, protected by 'lock'.
+    ssize_t retired_nalloc[max_memory_tags];
+    ssize_t retired_nfree[max_memory_tags];
+    ssize_t retired_nbytes_alloc[max_memory_tags];
+
+    // Shared by all threads, since the peak needs a global view of live bytes (see memory_utils.hpp).
+    std::atomic<ssize_t> live_nbytes[max_memory_tags];
+    std::atomic<ssize_t> peak_nbytes[max_memory_tags];
+    std::atomic<ssize_t> total_live_nbytes;
+    std::atomic<ssize_t> total_peak_nbytes;
+
+    memory_accounting_state() : tag_names(1, "untagged"), total_live_nbytes(0), total_peak_nbytes(0)
+    {
+	for (int i = 0; i < max_memory_tags; i++) {
+	    retired_nalloc[i] = retired_nfree[i] = retired_nbytes_alloc[i] = 0;
+	    live_nbytes[i].store(0);
+	    peak_nbytes[i].store(0);
+	}
+    }
+};
+
+static memory_accounting_state &get_state()
+{
+    static memory_accounting_state *s = new memory_accounting_state;
+    return *s;
+}
+
+
+thread_local int _current_memory_tag = 0;
+
+
+int get_memory_tag(const string &name)
+{
+    memory_accounting_state &s = get_state();
+    lock_guard<mutex> l(s.lock);
+
+    for (size_t i = 0; i < s.tag_names.size(); i++)
+	if (s.tag_names[i] == name)
+	    return i;
+
+    if (s.tag_names.size() >= max_memory_tags)
+	throw runtime_error("get_memory_tag(): too many tags (max_memory_tags=" + to_string(max_memory_tags) + ")");
+
+    s.tag_names.push_back(name);
+    return s.tag_names.size() - 1;
+}
+
+
+#ifdef MEMORY_ACCOUNTING
+
+static thread_local thread_memory_counters *_thread_counters = nullptr;
+
+
+// Retires the calling thread's counters when the thread exits: adds them into the global totals
+// (under the lock, so that reports never miss or double-count them), then frees them.
+struct thread_counters_holder {
+    ~thread_counters_holder()
+    {
+	thread_memory_counters *c = _thread_counters;
+	if (!c)
+	    return;
+
+	memory_accounting_state &s = get_state();
+	lock_guard<mutex> l(s.lock);
+
+	for (int i = 0; i < max_memory_tags; i++) {
+	    s.retired_nalloc[i] += c->nalloc[i].load(memory_order_relaxed);
+	    s.retired_nfree[i] += c->nfree[i].load(memory_order_relaxed);
+	    s.retired_nbytes_alloc[i] += c->nbytes_alloc[i].load(memory_order_relaxed);
+	}
+
+	for (auto p = s.all_counters.begin(); p != s.all_counters.end(); p++) {
+	    if (p->get() == c) {
+		s.all_counters.erase(p);
+		break;
+	    }
+	}
+
+	_thread_counters = nullptr;
+    }
+};
+
+
+static thread_memory_counters &get_thread_counters()
+{
+    // The holder is only constructed on the first call, and its destructor retires the counters.
+    // If the thread allocates again after that (from another thread_local destructor), we register
+    // a fresh block, which is then never retired.  This is rare, and only costs one block per thread.
+    static thread_local thread_counters_holder holder;
+
+    if (!_thread_counters) {
+	memory_accounting_state &s = get_state();
+	lock_guard<mutex> l(s.lock);
+	s.all_counters.push_back(unique_ptr<thread_memory_counters> (new thread_memory_counters));
+	_thread_counters = s.all_counters.back().get();
+    }
+
+    return *_thread_counters;
+}
+
+static inline void _bump(std::atomic<ssize_t> &x, ssize_t n)
+{
+    x.store(x.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline void _update_peak(std::atomic<ssize_t> &live, std::atomic<ssize_t> &peak, ssize_t nbytes)
+{
+    ssize_t n = live.fetch_add(nbytes, memory_order_relaxed) + nbytes;
+    ssize_t p = peak.load(memory_order_relaxed);
+
+    while ((n > p) && !peak.compare_exchange_weak(p, n, memory_order_relaxed))
+	;
+}
+
+
+// Header which precedes each accounted allocation (immediately before the pointer returned to the caller).
+struct alloc_header {
+    uint64_t nbytes;
+    uint32_t tag;
+    uint32_t offset;   // distance from start of posix_memalign() allocation to user pointer
+};
+
+static_assert(sizeof(alloc_header) == 16, "alloc_header is expected to be 16 bytes");
+
+
+void *_accounted_alloc(size_t nbytes, size_t nalign, bool zero)
+{
+    size_t offset = max(nalign, sizeof(alloc_header));
+
+    void *p = NULL;
+    if (posix_memalign(&p, nalign, nbytes + offset) != 0)
+        throw std::runtime_error("couldn't allocate memory");
+
+    char *ret = reinterpret_cast<char *> (p) + offset;
+    int tag = _current_memory_tag;
+
+    alloc_header *h = reinterpret_cast<alloc_header *> (ret) - 1;
+    h->nbytes = nbytes;
+    h->tag = tag;
+    h->offset = offset;
+
+    if (zero)
+	memset(ret, 0, nbytes);
+
+    memory_accounting_state &s = get_state();
+    thread_memory_counters &c = get_thread_counters();
+
+    _bump(c.nalloc[tag], 1);
+    _bump(c.nbytes_alloc[tag], nbytes);
+    _update_peak(s.live_nbytes[tag], s.peak_nbytes[tag], nbytes);
+    _update_peak(s.total_live_nbytes, s.total_peak_nbytes, nbytes);
+
+    return ret;
+}
+
+
+void _accounted_free(void *p)
+{
+    if (!p)
+	return;
+
+    alloc_header *h = reinterpret_cast<alloc_header *> (p) - 1;
+    ssize_t nbytes = h->nbytes;
+    int tag = h->tag;
+
+    memory_accounting_state &s = get_state();
+    thread_memory_counters &c = get_thread_counters();
+
+    _bump(c.nfree[tag], 1);
+    _bump(c.nbytes_free[tag], nbytes);
+    s.live_nbytes[tag].fetch_sub(nbytes, memory_order_relaxed);
+    s.total_live_nbytes.fetch_sub(nbytes, memory_order_relaxed);
+
+    free(reinterpret_cast<char *> (p) - h->offset);
+}
+
+#endif  // MEMORY_ACCOUNTING
+
+
+vector<memory_accounting_stats> get_memory_accounting_stats()
+{
+    vector<memory_accounting_stats> ret;
+
+#ifdef MEMORY_ACCOUNTING
+    memory_accounting_state &s = get_state();
+    lock_guard<mutex> l(s.lock);
+
+    int ntags = s.tag_names.size();
+    ret.resize(ntags + 1);
+
+    for (int i = 0; i < ntags; i++) {
+	ret[i].tag = s.tag_names[i];
+	ret[i].live_nbytes = s.live_nbytes[i].load();
+	ret[i].peak_nbytes = s.peak_nbytes[i].load();
+	ret[i].nalloc = s.retired_nalloc[i];
+	ret[i].nfree = s.retired_nfree[i];
+	ret[i].total_nbytes = s.retired_nbytes_alloc[i];
+
+	for (const auto &c: s.all_counters) {
+	    ret[i].nalloc += c->nalloc[i].load(memory_order_relaxed);
+	    ret[i].nfree += c->nfree[i].load(memory_order_relaxed);
+	    ret[i].total_nbytes += c->nbytes_alloc[i].load(memory_order_relaxed);
+	}
+    }
+
+    memory_accounting_stats &t = ret[ntags];
+    t.tag = "total";
+    t.live_nbytes = s.total_live_nbytes.load();
+    t.peak_nbytes = s.total_peak_nbytes.load();
+
+    for (int i = 0; i < ntags; i++) {
+	t.nalloc += ret[i].nalloc;
+	t.nfree += ret[i].nfree;
+	t.total_nbytes += ret[i].total_nbytes;
+    }
+#endif
+
+    return ret;
+}
+
+
+void print_memory_accounting_report(ostream &os)
+{
+    ssize_t nphys = get_physical_memory();
+    ssize_t nrss = get_resident_memory();
+    double gb = pow(2., 30.);
+
+    os << "physical memory: " << (nphys / gb) << " GB, resident set size: " << (nrss / gb) << " GB" << endl;
+
+#ifndef MEMORY_ACCOUNTING
+    os << "memory accounting is disabled (compile with -DMEMORY_ACCOUNTING to enable)" << endl;
+#else
+    for (const memory_accounting_stats &m: get_memory_accounting_stats()) {
+	if ((m.nalloc == 0) && (m.tag != "total"))
+	    continue;
+
+	os << "    " << m.tag << ": live " << (m.live_nbytes / gb) << " GB"
+	   << " (" << (100. * m.live_nbytes / nrss) << "% of RSS, " << (100. * m.live_nbytes / nphys) << "% of physical)"
+	   << ", peak " << (m.peak_nbytes / gb) << " GB"
+	   << ", " << m.nalloc << " allocs, " << m.nfree << " frees" << endl;
+    }
+#endif
+}
+
+
+ssize_t get_physical_memory()
+{
+    ssize_t pagesize = sysconf(_SC_PAGESIZE);
+    if (pagesize < 0)
+	throw runtime_error(string("sysconf(_SC_PAGESIZE) failed: ") + strerror(errno));
+
+    ssize_t npages = sysconf(_SC_PHYS_PAGES);
+    if (npages < 0)
+	throw runtime_error(string("sysconf(_SC_PHYS_PAGES) failed: ") + strerror(errno));
+
+    ssize_t nbytes = npages * pagesize;
+
+    if (nbytes <= 0)
+	throw runtime_error("get_physical_memory(): zero bytes found?!");
+
+    return nbytes;
+}
+
+
+ssize_t get_resident_memory()
+{
+    // /proc/self/statm contains (in pages): total program size, resident set size, ...
+    ifstream f("/proc/self/statm");
+    ssize_t npages_total = 0, npages_resident = 0;
+
+    if (!(f >> npages_total >> npages_resident))
+	throw runtime_error("get_resident_memory(): couldn't read /proc/self/statm");
+
+    return npages_resident * sysconf(_SC_PAGESIZE);
+}
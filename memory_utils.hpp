@@ -1,9 +1,88 @@
-// Coming soon: an Allocator class (for std::vector, etc.) which uses aligned_alloc()
+#ifndef _MEMORY_UTILS_HPP
+#define _MEMORY_UTILS_HPP
 
 #include <memory>
+#include <string>
+#include <vector>
+#include <iostream>
 #include <cstdlib>
 #include <cstring>
+#include <cstdint>
 #include <stdexcept>
+#include <sys/mman.h>
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// Allocation accounting.
+//
+// If compiled with -DMEMORY_ACCOUNTING, every aligned_alloc() (and therefore make_uptr(), make_sptr(),
+// etc.) is tagged and counted, so that we can tell how much memory is in our own buffers versus
+// everything else.  Tags are assigned per-thread with an RAII scope:
+//
+//   {
+//       memory_tag_scope t("fft buffers");
+//       uptr<float> p = make_uptr<float> (nelts);    // counted under "fft buffers"
+//   }
+//
+//   print_memory_accounting_report();    // per-tag live/peak bytes, compared with RSS and physical memory
+//
+// Counts and byte totals are kept in per-thread counters (plain relaxed stores, no read-modify-writes),
+// which are merged when a report is requested.  When a thread exits, its counters are folded into global
+// totals and freed, so memory use and report cost stay bounded in programs which create many threads.
+//
+// Live and peak bytes can't be kept that way: a buffer is often freed by a different thread than the one
+// which allocated it, and the peak of the sum over threads can't be reconstructed from per-thread values
+// after the fact.  So live bytes (per tag, and in total) are kept in process-wide relaxed atomics: each
+// allocation or free does two fetch_add()s on shared cache lines, plus a compare-and-swap when a new peak
+// is reached.  Uncontended, this costs about 10 ns per alloc/free pair (on top of ~100 ns for
+// posix_memalign() and free()).  If many threads allocate concurrently, the shared cache lines bounce
+// between cores, and the cost can rise to ~100 ns.  That's fine for buffers which are allocated outside
+// inner loops; for high-rate allocation, use buffer_pool or memory_arena.
+//
+// Each accounted allocation is preceded by a small header (which records the size and tag), so memory
+// from aligned_alloc() must be freed with aligned_free(), not free().  All translation units in the
+// program (including memory_utils.cpp) must agree on whether MEMORY_ACCOUNTING is defined; if
+// memory_utils.cpp is compiled without it, programs built with it will fail to link.
+
+
+struct memory_accounting_stats {
+    std::string tag;
+    ssize_t nalloc = 0;
+    ssize_t nfree = 0;
+    ssize_t live_nbytes = 0;
+    ssize_t peak_nbytes = 0;
+    ssize_t total_nbytes = 0;    // cumulative over all allocations
+};
+
+// Returns a tag ID (creating it if necessary).  Tag 0 is "untagged".
+extern int get_memory_tag(const std::string &name);
+
+// Returns one entry per tag, plus a final entry with tag "total".  Empty unless MEMORY_ACCOUNTING is defined.
+extern std::vector<memory_accounting_stats> get_memory_accounting_stats();
+
+extern void print_memory_accounting_report(std::ostream &os=std::cout);
+
+// Total physical memory on this machine, and resident set size of the current process, in bytes.
+extern ssize_t get_physical_memory();
+extern ssize_t get_resident_memory();
+
+extern thread_local int _current_memory_tag;
+
+struct memory_tag_scope {
+    int saved_tag;
+
+    memory_tag_scope(const std::string &name) : saved_tag(_current_memory_tag) { _current_memory_tag = get_memory_tag(name); }
+    ~memory_tag_scope() { _current_memory_tag = saved_tag; }
+
+    memory_tag_scope(const memory_tag_scope &) = delete;
+    memory_tag_scope &operator=(const memory_tag_scope &) = delete;
+};
+
+#ifdef MEMORY_ACCOUNTING
+extern void *_accounted_alloc(size_t nbytes, size_t nalign, bool zero);
+extern void _accounted_free(void *p);
+#endif
 
 
 // -------------------------------------------------------------------------------------------------
@@ -17,6 +96,9 @@ inline T *aligned_alloc(size_t nelts, size_t nalign=128, bool zero=true)
     if (nelts == 0)
         return NULL;
 
+#ifdef MEMORY_ACCOUNTING
+    return reinterpret_cast<T *> (_accounted_alloc(nelts * sizeof(T), nalign, zero));
+#else
     void *p = NULL;
     if (posix_memalign(&p, nalign, nelts * sizeof(T)) != 0)
         throw std::runtime_error("couldn't allocate memory");
@@ -25,6 +107,18 @@ inline T *aligned_alloc(size_t nelts, size_t nalign=128, bool zero=true)
 	memset(p, 0, nelts * sizeof(T));
 
     return reinterpret_cast<T *> (p);
+#endif
+}
+
+
+// Frees memory returned by aligned_alloc().
+inline void aligned_free(void *p)
+{
+#ifdef MEMORY_ACCOUNTING
+    _accounted_free(p);
+#else
+    free(p);
+#endif
 }
 
 
@@ -44,7 +138,7 @@ inline bool is_aligned(const void *ptr, uintptr_t nbytes)
 
 
 struct uptr_deleter {
-    inline void operator()(const void *p) { free(const_cast<void *> (p)); }
+    inline void operator()(const void *p) { aligned_free(const_cast<void *> (p)); }
 };
 
 template<typename T>
@@ -65,7 +159,7 @@ inline uptr<T> make_uptr(size_t nelts, size_t nalign=128, bool zero=true)
 // shared_ptr<float[]> p = make_sptr<float> (nelts);
 
 
-static void sptr_deleter(const void *p) { free(p); }
+inline void sptr_deleter(const void *p) { aligned_free(const_cast<void *> (p)); }
 
 template<typename T>
 inline std::shared_ptr<T[]> make_sptr(size_t nelts, size_t nalign=128, bool zero=true)
@@ -75,6 +169,70 @@ inline std::shared_ptr<T[]> make_sptr(size_t nelts, size_t nalign=128, bool zero
 }
 
 
+// -------------------------------------------------------------------------------------------------
+//
+// NUMA-aware allocation.
+//
+// On a multi-socket machine, the kernel places each page on the NUMA node of the thread which first
+// touches it, so zeroing a large buffer with a single memset() puts the whole buffer on one node.
+// The functions below zero (or just pre-fault) the buffer from a set of threads, each pinned to one
+// core in 'cores', so that pages end up where they will be used.  The 'policy' argument says which
+// thread touches which page:
+//
+//   NUMA_LOCAL       all pages go to the NUMA node of the calling thread (via mbind()), but zeroing
+//                    is still split across the pinned threads.
+//   NUMA_INTERLEAVE  page k is touched by thread (k % nthreads).
+//   NUMA_BLOCKED     the buffer is split into nthreads contiguous slices, and thread i touches slice i.
+//                    A worker thread pinned to cores[i] which later accesses slice i hits local memory.
+//
+// If 'zero' is false, pages are faulted in without changing their contents.
+//
+// Usage:
+//
+//   uptr<float> p = make_uptr_numa<float> (nelts, { 0, 1, 2, 3 }, NUMA_BLOCKED);
+//
+// These functions are defined in memory_utils.cpp, which must be linked together with cpu_affinity.o.
+
+
+enum numa_policy {
+    NUMA_LOCAL = 0,
+    NUMA_INTERLEAVE = 1,
+    NUMA_BLOCKED = 2
+};
+
+extern void parallel_first_touch(void *p, size_t nbytes, const std::vector<int> &cores, numa_policy policy, bool zero=true);
+
+
+template<typename T>
+inline T *aligned_alloc_numa(size_t nelts, const std::vector<int> &cores, numa_policy policy, size_t nalign=128, bool zero=true)
+{
+    T *p = aligned_alloc<T> (nelts, nalign, false);
+
+    try {
+	parallel_first_touch(p, nelts * sizeof(T), cores, policy, zero);
+    } catch (...) {
+	aligned_free(p);
+	throw;
+    }
+
+    return p;
+}
+
+template<typename T>
+inline uptr<T> make_uptr_numa(size_t nelts, const std::vector<int> &cores, numa_policy policy, size_t nalign=128, bool zero=true)
+{
+    T *p = aligned_alloc_numa<T> (nelts, cores, policy, nalign, zero);
+    return uptr<T> (p);
+}
+
+template<typename T>
+inline std::shared_ptr<T[]> make_sptr_numa(size_t nelts, const std::vector<int> &cores, numa_policy policy, size_t nalign=128, bool zero=true)
+{
+    T *p = aligned_alloc_numa<T> (nelts, cores, policy, nalign, zero);
+    return std::shared_ptr<T[]> (p, sptr_deleter);
+}
+
+
 // -------------------------------------------------------------------------------------------------
 //
 // make_unique().  This is in C++14 but not C++11.
@@ -85,3 +243,137 @@ std::unique_ptr<T> make_unique(Args&&... args)
 {
     return std::unique_ptr<T>(new T(std::forward<Args>(args)...));
 }
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// aligned_allocator<T>: an allocator (for std::vector, etc.) which uses aligned_alloc().
+//
+//   std::vector<float, aligned_allocator<float>> v(nelts);
+//
+// Large allocations (>= hugepage_threshold bytes) can optionally be backed by huge pages, to cut
+// down on TLB misses in multi-GB buffers:
+//
+//   aligned_allocator<float> a(HUGEPAGES_TRANSPARENT);   // mmap() + madvise(MADV_HUGEPAGE)
+//   aligned_allocator<float> a(HUGEPAGES_HUGETLB);       // mmap(MAP_HUGETLB), fall back to MADV_HUGEPAGE
+//   std::vector<float, aligned_allocator<float>> v(nelts, 0.0, a);
+//
+// If huge pages are unavailable (e.g. MAP_HUGETLB with no pages reserved in /proc/sys/vm/nr_hugepages,
+// or transparent huge pages disabled), we silently fall back to ordinary pages.
+//
+// Note that the allocator does not zero memory (std::vector initializes its elements anyway).
+
+
+enum hugepage_mode {
+    HUGEPAGES_NONE = 0,
+    HUGEPAGES_TRANSPARENT = 1,
+    HUGEPAGES_HUGETLB = 2
+};
+
+static constexpr size_t hugepage_size = 2 << 20;
+
+
+inline size_t _hugepage_round_up(size_t nbytes)
+{
+    return ((nbytes + hugepage_size - 1) / hugepage_size) * hugepage_size;
+}
+
+// Returns fresh (untouched) mmap() pages, aligned to hugepage_size.  With HUGEPAGES_NONE, transparent
+// huge pages are explicitly disabled for the region (MADV_NOHUGEPAGE), so that it is backed by ordinary
+// pages even if THP is set to "always".  Caller must call hugepage_free() with the same 'nbytes'.
+inline void *hugepage_alloc(size_t nbytes, hugepage_mode mode)
+{
+    size_t n = _hugepage_round_up(nbytes);
+
+#ifdef MAP_HUGETLB
+    if (mode == HUGEPAGES_HUGETLB) {
+	void *p = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED)
+	    return p;
+    }
+#endif
+
+    // Overallocate by one huge page, then trim, so that the result is aligned to hugepage_size
+    // (required for the kernel to back the region with transparent huge pages).
+    char *p = (char *) mmap(NULL, n + hugepage_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+	throw std::runtime_error("couldn't allocate memory");
+
+    size_t head = (hugepage_size - (uintptr_t(p) % hugepage_size)) % hugepage_size;
+
+    if (head > 0)
+	munmap(p, head);
+    munmap(p + head + n, hugepage_size - head);
+
+    p += head;
+
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+    // Failure is harmless here (e.g. THP disabled), so we don't check the return value.
+    madvise(p, n, (mode != HUGEPAGES_NONE) ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+#endif
+
+    return p;
+}
+
+inline void hugepage_free(void *p, size_t nbytes)
+{
+    if (p)
+	munmap(p, _hugepage_round_up(nbytes));
+}
+
+
+template<typename T, size_t Align=128>
+struct aligned_allocator {
+    typedef T value_type;
+    template<typename U> struct rebind { typedef aligned_allocator<U,Align> other; };
+
+    hugepage_mode mode;
+    size_t hugepage_threshold;
+
+    aligned_allocator(hugepage_mode mode_=HUGEPAGES_NONE, size_t hugepage_threshold_=hugepage_size) noexcept :
+	mode(mode_), hugepage_threshold(hugepage_threshold_)
+    { }
+
+    template<typename U>
+    aligned_allocator(const aligned_allocator<U,Align> &a) noexcept :
+	mode(a.mode), hugepage_threshold(a.hugepage_threshold)
+    { }
+
+    // Note: deallocate() relies on getting the same 'nelts' as allocate(), to decide which path was taken.
+    inline bool _use_hugepages(size_t nelts) const
+    {
+	return (mode != HUGEPAGES_NONE) && (Align <= hugepage_size) && (nelts * sizeof(T) >= hugepage_threshold);
+    }
+
+    inline T *allocate(size_t nelts)
+    {
+	if (nelts > SIZE_MAX / sizeof(T))
+	    throw std::bad_alloc();
+	if (_use_hugepages(nelts))
+	    return reinterpret_cast<T *> (hugepage_alloc(nelts * sizeof(T), mode));
+	return aligned_alloc<T> (nelts, Align, false);
+    }
+
+    inline void deallocate(T *p, size_t nelts)
+    {
+	if (_use_hugepages(nelts))
+	    hugepage_free(p, nelts * sizeof(T));
+	else
+	    aligned_free(p);
+    }
+};
+
+template<typename T, typename U, size_t Align>
+inline bool operator==(const aligned_allocator<T,Align> &a, const aligned_allocator<U,Align> &b)
+{
+    return (a.mode == b.mode) && (a.hugepage_threshold == b.hugepage_threshold);
+}
+
+template<typename T, typename U, size_t Align>
+inline bool operator!=(const aligned_allocator<T,Align> &a, const aligned_allocator<U,Align> &b)
+{
+    return !(a == b);
+}
+
+
+#endif  // _MEMORY_UTILS_HPP
@@ -0,0 +1,174 @@
+#ifndef _PARALLEL_FOR_HPP
+#define _PARALLEL_FOR_HPP
+
+#include <atomic>
+#include <future>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "task_pool.hpp"
+#include "memory_utils.hpp"
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// parallel_for() and parallel_reduce(), over the pinned worker threads of a task_pool.
+//
+//   parallel_for(pool, 0, n, [&](ssize_t i) { y[i] = a * x[i]; });
+//
+//   double s = parallel_reduce(pool, 0, n, 0.0,
+//                              [&](ssize_t i, double &acc) { acc += x[i]; },     // accumulate
+//                              [](double a, double b) { return a + b; });        // combine
+//
+// The loop body is a template parameter, so it is inlined into the inner loop (no std::function).
+// One task is submitted per worker (with task_pool::submit_to()), which then processes chunks of
+// the index range according to the schedule:
+//
+//   SCHEDULE_STATIC   worker w gets a fixed contiguous slice (see static_slice()), or if chunk > 0,
+//                     chunks are dealt round-robin.  No synchronization inside the loop.
+//   SCHEDULE_DYNAMIC  workers grab chunks of size 'chunk' from a shared atomic counter (default chunk
+//                     is n / (16 * nworkers)).  Use when work per element varies.
+//   SCHEDULE_GUIDED   like dynamic, but chunk size starts at remaining / (2 * nworkers) and shrinks
+//                     down to 'chunk' (default 1) as the range is used up.
+//
+// Deterministic slice ownership: with SCHEDULE_STATIC and chunk=0, worker w always processes
+// static_slice(begin, end, nworkers, w), on cpu pool.cpus[w].  Buffers allocated with
+// make_uptr_for_pool() are first-touched with the same blocked layout (NUMA_BLOCKED, up to page
+// rounding), so each worker's slice is in its local NUMA node.
+//
+// parallel_reduce() combines per-worker partial results in worker order, so it is deterministic
+// with SCHEDULE_STATIC (but not with the dynamic schedules, if 'combine' is not associative, e.g.
+// floating-point addition).
+//
+// Must not be called concurrently from several threads on the same pool if the pool is also being
+// used for other work, since each call occupies every worker until it completes.
+
+
+enum parallel_schedule {
+    SCHEDULE_STATIC = 0,
+    SCHEDULE_DYNAMIC = 1,
+    SCHEDULE_GUIDED = 2
+};
+
+
+// Slice [lo,hi) of [begin,end) owned by worker w (of nworkers) under SCHEDULE_STATIC.
+inline void static_slice(ssize_t begin, ssize_t end, int nworkers, int w, ssize_t &lo, ssize_t &hi)
+{
+    ssize_t n = std::max(end - begin, ssize_t(0));
+    lo = begin + (w * n) / nworkers;
+    hi = begin + ((w+1) * n) / nworkers;
+}
+
+
+// Allocates a buffer whose pages are first-touched by the pool's cpus in blocked layout.
+template<typename T>
+inline uptr<T> make_uptr_for_pool(const task_pool &pool, size_t nelts, size_t nalign=128, bool zero=true)
+{
+    return make_uptr_numa<T> (nelts, pool.cpus, NUMA_BLOCKED, nalign, zero);
+}
+
+
+// Calls f(w, lo, hi) for chunks [lo,hi) of [begin,end), on worker w.  Helper for parallel_for()
+// and parallel_reduce(), but can also be used directly for range-based loop bodies.
+template<typename F>
+inline void parallel_for_chunks(task_pool &pool, ssize_t begin, ssize_t end, const F &f, parallel_schedule sched=SCHEDULE_STATIC, ssize_t chunk=0)
+{
+    int nworkers = pool.nworkers;
+    ssize_t n = end - begin;
+
+    if (n <= 0)
+	return;
+    if ((sched != SCHEDULE_STATIC) && (sched != SCHEDULE_DYNAMIC) && (sched != SCHEDULE_GUIDED))
+	throw std::runtime_error("parallel_for: invalid schedule");
+    if (chunk < 0)
+	throw std::runtime_error("parallel_for: chunk must be >= 0");
+
+    if ((sched == SCHEDULE_DYNAMIC) && (chunk == 0))
+	chunk = std::max(n / (16 * nworkers), ssize_t(1));
+    if ((sched == SCHEDULE_GUIDED) && (chunk == 0))
+	chunk = 1;
+
+    std::atomic<ssize_t> next(begin);
+
+    auto worker = [&](int w)
+    {
+	if ((sched == SCHEDULE_STATIC) && (chunk == 0)) {
+	    ssize_t lo, hi;
+	    static_slice(begin, end, nworkers, w, lo, hi);
+	    if (lo < hi)
+		f(w, lo, hi);
+	}
+	else if (sched == SCHEDULE_STATIC) {
+	    for (ssize_t lo = begin + w * chunk; lo < end; lo += nworkers * chunk)
+		f(w, lo, std::min(lo + chunk, end));
+	}
+	else if (sched == SCHEDULE_DYNAMIC) {
+	    for (;;) {
+		ssize_t lo = next.fetch_add(chunk, std::memory_order_relaxed);
+		if (lo >= end)
+		    break;
+		f(w, lo, std::min(lo + chunk, end));
+	    }
+	}
+	else {
+	    ssize_t lo = next.load(std::memory_order_relaxed);
+
+	    while (lo < end) {
+		ssize_t m = std::max(chunk, (end - lo) / (2 * nworkers));
+		if (next.compare_exchange_weak(lo, lo + m, std::memory_order_relaxed))
+		    f(w, lo, std::min(lo + m, end));   // note: on failure, 'lo' is reloaded
+	    }
+	}
+    };
+
+    std::vector<std::future<void>> futures(nworkers);
+
+    for (int w = 0; w < nworkers; w++)
+	futures[w] = pool.submit_to(w, [&worker,w]() { worker(w); });
+
+    // Wait for all workers before propagating any exception, since tasks reference our stack.
+    for (int w = 0; w < nworkers; w++)
+	pool.wait_until_ready(futures[w]);
+
+    for (int w = 0; w < nworkers; w++)
+	futures[w].get();
+}
+
+
+template<typename F>
+inline void parallel_for(task_pool &pool, ssize_t begin, ssize_t end, const F &body, parallel_schedule sched=SCHEDULE_STATIC, ssize_t chunk=0)
+{
+    parallel_for_chunks(pool, begin, end,
+			[&body](int w, ssize_t lo, ssize_t hi) {
+			    for (ssize_t i = lo; i < hi; i++)
+				body(i);
+			},
+			sched, chunk);
+}
+
+
+template<typename T, typename F, typename Op>
+inline T parallel_reduce(task_pool &pool, ssize_t begin, ssize_t end, const T &identity, const F &body, const Op &combine,
+			 parallel_schedule sched=SCHEDULE_STATIC, ssize_t chunk=0)
+{
+    std::vector<T> partials(pool.nworkers, identity);
+
+    parallel_for_chunks(pool, begin, end,
+			[&body,&partials](int w, ssize_t lo, ssize_t hi) {
+			    T acc = partials[w];    // local copy, so that the inner loop can keep it in registers
+			    for (ssize_t i = lo; i < hi; i++)
+				body(i, acc);
+			    partials[w] = acc;
+			},
+			sched, chunk);
+
+    T ret = identity;
+    for (int w = 0; w < pool.nworkers; w++)
+	ret = combine(ret, partials[w]);
+
+    return ret;
+}
+
+
+#endif  // _PARALLEL_FOR_HPP
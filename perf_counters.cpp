@@ -0,0 +1,173 @@
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "perf_counters.hpp"
+
+using namespace std;
+
+
+const char *perf_counter_name(int id)
+{
+    switch (id) {
+	case PERF_CYCLES: return "cycles";
+	case PERF_INSTRUCTIONS: return "instructions";
+	case PERF_LLC_MISSES: return "LLC misses";
+	case PERF_BRANCH_MISSES: return "branch misses";
+	case PERF_DTLB_MISSES: return "dTLB misses";
+    }
+    throw runtime_error("perf_counter_name(): invalid id");
+}
+
+
+#ifdef __linux__
+
+static int open_perf_event(uint32_t type, uint64_t config, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = (group_fd < 0) ? 1 : 0;    // group leader starts disabled, members follow leader
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // pid=0, cpu=-1: calling thread, on any cpu.
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+perf_counters::perf_counters()
+{
+    static const uint32_t types[PERF_NCOUNTERS] = {
+	PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE
+    };
+
+    static const uint64_t configs[PERF_NCOUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES,
+	PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+    };
+
+    for (int i = 0; i < PERF_NCOUNTERS; i++) {
+	fds[i] = -1;
+	ids[i] = 0;
+    }
+
+    fds[0] = open_perf_event(types[0], configs[0], -1);
+
+    if (fds[0] < 0) {
+	errmsg = string("perf_event_open() failed: ") + strerror(errno);
+	if ((errno == EACCES) || (errno == EPERM))
+	    errmsg += " (try lowering /proc/sys/kernel/perf_event_paranoid)";
+	return;
+    }
+
+    // Failure to open a group member is not fatal: available(i) returns false, and that counter reads as zero.
+    for (int i = 1; i < PERF_NCOUNTERS; i++)
+	fds[i] = open_perf_event(types[i], configs[i], fds[0]);
+
+    for (int i = 0; i < PERF_NCOUNTERS; i++) {
+	if ((fds[i] >= 0) && (ioctl(fds[i], PERF_EVENT_IOC_ID, &ids[i]) < 0)) {
+	    close(fds[i]);
+	    fds[i] = -1;
+	}
+    }
+
+    if (fds[0] < 0) {
+	for (int i = 1; i < PERF_NCOUNTERS; i++)
+	    if (fds[i] >= 0)
+		close(fds[i]);
+	errmsg = "ioctl(PERF_EVENT_IOC_ID) failed";
+    }
+}
+
+perf_counters::~perf_counters()
+{
+    for (int i = 0; i < PERF_NCOUNTERS; i++)
+	if (fds[i] >= 0)
+	    close(fds[i]);
+}
+
+void perf_counters::start()
+{
+    if (available())
+	ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void perf_counters::stop()
+{
+    if (available())
+	ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void perf_counters::reset()
+{
+    if (available())
+	ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+}
+
+void perf_counters::read(double *out) const
+{
+    for (int i = 0; i < PERF_NCOUNTERS; i++)
+	out[i] = 0.0;
+
+    if (!available())
+	return;
+
+    // Group read format: nr, time_enabled, time_running, then (value, id) pairs.
+    uint64_t buf[3 + 2*PERF_NCOUNTERS];
+    ssize_t n = ::read(fds[0], buf, sizeof(buf));
+
+    if ((n < ssize_t(3 * sizeof(uint64_t))) || (buf[2] == 0))
+	return;
+
+    double scale = double(buf[1]) / double(buf[2]);
+    uint64_t nr = buf[0];
+
+    // Match values to counters by event ID, since some group members may have failed to open.
+    for (int i = 0; i < PERF_NCOUNTERS; i++) {
+	if (fds[i] < 0)
+	    continue;
+
+	for (uint64_t j = 0; (j < nr) && (j < PERF_NCOUNTERS); j++)
+	    if (buf[3 + 2*j + 1] == ids[i])
+		out[i] = scale * double(buf[3 + 2*j]);
+    }
+}
+
+#else  // !__linux__
+
+perf_counters::perf_counters()
+{
+    for (int i = 0; i < PERF_NCOUNTERS; i++) {
+	fds[i] = -1;
+	ids[i] = 0;
+    }
+    errmsg = "perf counters are only implemented on linux";
+}
+
+perf_counters::~perf_counters() { }
+void perf_counters::start() { }
+void perf_counters::stop() { }
+void perf_counters::reset() { }
+
+void perf_counters::read(double *out) const
+{
+    for (int i = 0; i < PERF_NCOUNTERS; i++)
+	out[i] = 0.0;
+}
+
+#endif  // __linux__
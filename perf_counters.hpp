@@ -0,0 +1,68 @@
+#ifndef _PERF_COUNTERS_HPP
+#define _PERF_COUNTERS_HPP
+
+#include <string>
+#include <stdint.h>
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// perf_counters: hardware performance counters for the calling thread, via perf_event_open() (Linux).
+//
+//   perf_counters pc;     // must be constructed on the thread to be measured
+//   pc.start();
+//   ...
+//   pc.stop();
+//   double v[PERF_NCOUNTERS];
+//   pc.read(v);           // v[PERF_CYCLES], v[PERF_INSTRUCTIONS], ...
+//
+// The counters are opened as one group, so that they are scheduled onto the PMU together.
+// Kernel and hypervisor events are excluded, so this works with perf_event_paranoid <= 2.
+//
+// If perf_event_open() fails (e.g. no PMU in a VM, or a restrictive perf_event_paranoid setting),
+// then available() returns false and error_message() says why; start()/stop() become no-ops and
+// read() returns zeros.  If only some events are unsupported, then available(id) returns false for
+// those events, and they read as zero.  (We avoid NaN here, since it's unreliable with -ffast-math.)
+
+
+enum perf_counter_id {
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS = 1,
+    PERF_LLC_MISSES = 2,
+    PERF_BRANCH_MISSES = 3,
+    PERF_DTLB_MISSES = 4,
+    PERF_NCOUNTERS = 5
+};
+
+extern const char *perf_counter_name(int id);
+
+
+class perf_counters {
+public:
+    perf_counters();
+    ~perf_counters();
+
+    // Noncopyable (owns file descriptors)
+    perf_counters(const perf_counters &) = delete;
+    perf_counters &operator=(const perf_counters &) = delete;
+
+    bool available() const { return fds[PERF_CYCLES] >= 0; }
+    bool available(int id) const { return (id >= 0) && (id < PERF_NCOUNTERS) && (fds[id] >= 0); }
+    const std::string &error_message() const { return errmsg; }
+
+    // Counting is cumulative across start()/stop() pairs, until reset() is called.
+    void start();
+    void stop();
+    void reset();
+
+    // Values are scaled by (time enabled) / (time running), in case the PMU was multiplexed.
+    void read(double *out) const;
+
+protected:
+    int fds[PERF_NCOUNTERS];
+    uint64_t ids[PERF_NCOUNTERS];   // kernel event IDs, for matching up values in read()
+    std::string errmsg;
+};
+
+
+#endif  // _PERF_COUNTERS_HPP
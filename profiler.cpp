@@ -0,0 +1,201 @@
+#include <cmath>
+#include <memory>
+#include <iomanip>
+#include <algorithm>
+
+#include "profiler.hpp"
+
+using namespace std;
+
+
+thread_local _profile_thread *_profile_tls = nullptr;
+
+
+// Per-thread profiles are never freed, so that statistics outlive their threads.
+struct profile_registry {
+    mutex lock;
+    vector<unique_ptr<_profile_thread>> threads;
+};
+
+
+// Function-local static, so that regions can be profiled from static initializers.
+static profile_registry &get_profile_registry()
+{
+    static profile_registry r;
+    return r;
+}
+
+
+static _profile_thread *register_profile_thread()
+{
+    profile_registry &r = get_profile_registry();
+    lock_guard<mutex> l(r.lock);
+
+    _profile_thread *t = new _profile_thread;
+    t->nodes.resize(1);   // root
+    r.threads.push_back(unique_ptr<_profile_thread> (t));
+
+    _profile_tls = t;
+    return t;
+}
+
+
+int _profile_enter(const char *name)
+{
+    _profile_thread *t = _profile_tls ? _profile_tls : register_profile_thread();
+    _profile_tnode &parent = t->nodes[t->current];
+
+    for (int c: parent.children) {
+	if (t->nodes[c].name == name) {
+	    t->current = c;
+	    return c;
+	}
+    }
+
+    // First time on this call path.
+    lock_guard<mutex> l(t->lock);
+
+    int c = t->nodes.size();
+    t->nodes.resize(c+1);
+    t->nodes[c].name = name;
+    t->nodes[c].parent = t->current;
+    parent.children.push_back(c);
+
+    t->current = c;
+    return c;
+}
+
+
+const profile_node *profile_node::find(const string &name_) const
+{
+    for (const profile_node &c: children)
+	if (c.name == name_)
+	    return &c;
+    return nullptr;
+}
+
+
+// Adds the subtree rooted at t->nodes[i] to 'dst' (merging children by name).  Caller holds t->lock.
+static void merge_profile(profile_node &dst, const _profile_thread *t, int i)
+{
+    const _profile_tnode &n = t->nodes[i];
+
+    dst.count += n.count.load(memory_order_relaxed);
+    dst.total += 1.0e-9 * n.total_ns.load(memory_order_relaxed);
+    dst.max = max(dst.max, 1.0e-9 * n.max_ns.load(memory_order_relaxed));
+
+    for (int c: n.children) {
+	string name = t->nodes[c].name;
+	auto p = std::find_if(dst.children.begin(), dst.children.end(), [&name](const profile_node &x) { return x.name == name; });
+
+	if (p == dst.children.end()) {
+	    dst.children.push_back(profile_node());
+	    dst.children.back().name = name;
+	    p = dst.children.end() - 1;
+	}
+
+	merge_profile(*p, t, c);
+    }
+}
+
+
+// Computes self times and sorts children, after merging.
+static void finalize_profile(profile_node &p)
+{
+    double children_total = 0.0;
+
+    for (profile_node &c: p.children) {
+	finalize_profile(c);
+	children_total += c.total;
+    }
+
+    p.self = max(p.total - children_total, 0.0);
+
+    std::sort(p.children.begin(), p.children.end(),
+	      [](const profile_node &a, const profile_node &b) { return a.total > b.total; });
+}
+
+
+vector<profile_node> get_thread_profiles()
+{
+    profile_registry &r = get_profile_registry();
+    lock_guard<mutex> l(r.lock);
+
+    vector<profile_node> ret(r.threads.size());
+
+    for (size_t i = 0; i < r.threads.size(); i++) {
+	lock_guard<mutex> lt(r.threads[i]->lock);
+	merge_profile(ret[i], r.threads[i].get(), 0);
+	finalize_profile(ret[i]);
+    }
+
+    return ret;
+}
+
+
+profile_node get_profile()
+{
+    profile_registry &r = get_profile_registry();
+    lock_guard<mutex> l(r.lock);
+
+    profile_node ret;
+
+    for (const auto &t: r.threads) {
+	lock_guard<mutex> lt(t->lock);
+	merge_profile(ret, t.get(), 0);
+    }
+
+    finalize_profile(ret);
+    return ret;
+}
+
+
+void reset_profile()
+{
+    profile_registry &r = get_profile_registry();
+    lock_guard<mutex> l(r.lock);
+
+    for (const auto &t: r.threads) {
+	lock_guard<mutex> lt(t->lock);
+	for (_profile_tnode &n: t->nodes) {
+	    n.count.store(0, memory_order_relaxed);
+	    n.total_ns.store(0, memory_order_relaxed);
+	    n.max_ns.store(0, memory_order_relaxed);
+	}
+    }
+}
+
+
+static void print_profile_node(const profile_node &p, double parent_total, int depth, ostream &os)
+{
+    // Omit regions which haven't been entered since reset_profile().
+    if (p.count == 0)
+	return;
+
+    os << string(4*depth, ' ') << p.name << ": " << p.count << " calls, total " << p.total << " sec";
+
+    if (parent_total > 0.0)
+	os << " (" << (100. * p.total / parent_total) << "%)";
+
+    os << ", self " << p.self << " sec, mean " << (p.total / p.count) << " sec, max " << p.max << " sec" << endl;
+
+    for (const profile_node &c: p.children)
+	print_profile_node(c, p.total, depth+1, os);
+}
+
+
+void print_profile(const profile_node &p, ostream &os)
+{
+    auto prec = os.precision(4);
+
+    for (const profile_node &c: p.children)
+	print_profile_node(c, 0.0, 0, os);
+
+    os.precision(prec);
+}
+
+
+void print_profile(ostream &os)
+{
+    print_profile(get_profile(), os);
+}
@@ -0,0 +1,130 @@
+#ifndef _PROFILER_HPP
+#define _PROFILER_HPP
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+
+#include "time.hpp"
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// Scoped region profiler: RAII timers (on get_monotonic_ns()), aggregated into a per-thread call tree.
+//
+//   void process_chunk()
+//   {
+//       PROFILE_SCOPE("process_chunk");
+//       ...
+//       {
+//           PROFILE_SCOPE("fft");      // recorded as a child of "process_chunk"
+//           ...
+//       }
+//   }
+//
+//   print_profile();                   // merged over threads; callable at any time (e.g. from a status command)
+//
+// Each tree node is a call path (so the same region called from two places appears twice), with
+// count, total time, self time (total minus children) and max time.  Each thread updates its own tree
+// without locks, except when it enters a call path for the first time.  Readers (get_profile() etc.)
+// can run concurrently with the threads being profiled, and see each region's statistics as of its
+// most recent exit (regions which haven't exited yet are not included).
+//
+// The overhead is two clock reads plus a few nanoseconds per scope, so it's intended to stay compiled
+// in, for regions which run for microseconds or longer.  (For a timeline of individual events, see
+// trace.hpp instead.)  Region names are compared as pointers, so they must be string literals (or
+// otherwise outlive the profile); names are merged by value across threads.
+
+
+// One node of a merged call tree.  Times are in seconds.
+struct profile_node {
+    std::string name;
+    int64_t count = 0;
+    double total = 0.0;
+    double self = 0.0;
+    double max = 0.0;
+
+    std::vector<profile_node> children;   // sorted by decreasing total time
+
+    const profile_node *find(const std::string &name) const;   // child with given name, or nullptr
+};
+
+// Root node (with empty name) whose children are the top-level regions.  Thread-safe.
+extern profile_node get_profile();                        // merged over all threads
+extern std::vector<profile_node> get_thread_profiles();   // one per thread, in order of first use
+
+// Prints an indented tree with count/total/self/max per region, and percentages of the parent's total.
+extern void print_profile(std::ostream &os=std::cout);
+extern void print_profile(const profile_node &p, std::ostream &os=std::cout);
+
+// Zeroes all statistics (the call tree structure is kept).  Can be called concurrently with profiled
+// threads, but updates in progress at the time of the call may be partially lost.
+extern void reset_profile();
+
+
+// Per-thread state, used by profile_scope.
+struct _profile_tnode {
+    const char *name = nullptr;
+    int parent = -1;
+    std::vector<int> children;    // appended under _profile_thread::lock
+
+    // Written only by the owning thread (relaxed load + store), read by get_profile().
+    std::atomic<int64_t> count;
+    std::atomic<int64_t> total_ns;
+    std::atomic<int64_t> max_ns;
+
+    _profile_tnode() : count(0), total_ns(0), max_ns(0) { }
+};
+
+struct _profile_thread {
+    std::mutex lock;                   // held by readers, and by the owner when adding nodes
+    std::deque<_profile_tnode> nodes;  // nodes[0] is the root; a deque doesn't move elements when appending
+    int current = 0;
+};
+
+// Calling thread's state (created by the first _profile_enter()).
+extern thread_local _profile_thread *_profile_tls;
+
+extern int _profile_enter(const char *name);   // returns node index (and makes it current)
+
+
+class profile_scope {
+public:
+    profile_scope(const char *name) :
+	node(_profile_enter(name)),
+	start_ns(get_monotonic_ns())
+    { }
+
+    ~profile_scope()
+    {
+	int64_t dt = get_monotonic_ns() - start_ns;
+	_profile_thread *t = _profile_tls;
+	_profile_tnode &n = t->nodes[node];
+
+	n.count.store(n.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	n.total_ns.store(n.total_ns.load(std::memory_order_relaxed) + dt, std::memory_order_relaxed);
+	if (dt > n.max_ns.load(std::memory_order_relaxed))
+	    n.max_ns.store(dt, std::memory_order_relaxed);
+
+	t->current = n.parent;
+    }
+
+    profile_scope(const profile_scope &) = delete;
+    profile_scope &operator=(const profile_scope &) = delete;
+
+protected:
+    const int node;
+    const int64_t start_ns;
+};
+
+
+#define _PROFILE_CONCAT2(x, y) x ## y
+#define _PROFILE_CONCAT(x, y) _PROFILE_CONCAT2(x, y)
+#define PROFILE_SCOPE(name) profile_scope _PROFILE_CONCAT(_profile_scope_, __LINE__) (name)
+
+
+#endif  // _PROFILER_HPP
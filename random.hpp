@@ -1,5 +1,13 @@
+#include <cmath>
 #include <random>
 #include <vector>
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
 
 // Reminder: an RNG is initialized with
 //
@@ -90,6 +98,373 @@ template<typename T> inline std::vector<T> gaussian_randvec(std::mt19937 &rng, s
 }
 
 
+// -------------------------------------------------------------------------------------------------
+//
+// Philox4x32-10 counter-based RNG, with vectorized bulk fills.
+//
+//   philox_rng rng(seed);                  // or philox_rng(seed, stream), for independent streams
+//   uniform_rand(rng, dst, n, lo, hi);     // dst is a float* or double* (or std::vector)
+//   gaussian_rand(rng, dst, n, rms);
+//
+// Philox4x32-10 (Salmon, Moraes, Dror & Shaw, SC 2011) maps a 128-bit counter and a 64-bit key to
+// 128 random bits.  Here the key is the seed, and the counter is (block index, stream).  A fill of n
+// floats uses the next ceil(n/4) blocks (ceil(n/2) for doubles): element i is 32-bit word (i % 4) of
+// block (position + i/4), or the 64-bit word (i % 2) of block (position + i/2) for doubles.  Floats
+// have 24 random bits, and doubles have 52.
+//
+// Output depends only on (seed, stream, position).  In particular, the AVX2 and AVX-512 code paths
+// (used if compiled with -mavx2 or -mavx512f, e.g. -march=native) are bitwise identical to the scalar
+// path.  Uniform values are converted exactly, and _philox_barrier() prevents the compiler from fusing
+// or reassociating the floating-point ops (e.g. into an FMA, in some builds but not others).
+//
+// Gaussian fills use Box-Muller on vectorized uniforms, but the transform itself is scalar, since
+// vectorized log/sin/cos are not bitwise identical to the scalar libm versions.
+
+
+struct philox_rng {
+    uint32_t key[2];
+    uint32_t stream[2];
+    uint64_t position = 0;    // index of the next counter block
+
+    philox_rng(uint64_t seed, uint64_t stream_=0)
+    {
+	key[0] = uint32_t(seed);
+	key[1] = uint32_t(seed >> 32);
+	stream[0] = uint32_t(stream_);
+	stream[1] = uint32_t(stream_ >> 32);
+    }
+
+    static inline void philox4x32_10(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4])
+    {
+	uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+	uint32_t k0 = key[0], k1 = key[1];
+
+	for (int r = 0; r < 10; r++) {
+	    uint64_t p0 = uint64_t(0xd2511f53) * c0;
+	    uint64_t p1 = uint64_t(0xcd9e8d57) * c2;
+
+	    c0 = uint32_t(p1 >> 32) ^ c1 ^ k0;
+	    c1 = uint32_t(p1);
+	    c2 = uint32_t(p0 >> 32) ^ c3 ^ k1;
+	    c3 = uint32_t(p0);
+
+	    k0 += 0x9e3779b9;
+	    k1 += 0xbb67ae85;
+	}
+
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+    }
+
+    // Counter (block, stream) -> 128 random bits.
+    inline void generate_block(uint64_t block, uint32_t out[4]) const
+    {
+	uint32_t ctr[4] = { uint32_t(block), uint32_t(block >> 32), stream[0], stream[1] };
+	philox4x32_10(ctr, key, out);
+    }
+};
+
+
+// Returns x, but the compiler can't see through it (see above).
+template<typename T> inline T _philox_barrier(T x)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    asm("" : "+v" (x));
+#else
+    asm("" : "+m" (x));
+#endif
+    return x;
+}
+
+// 32 random bits -> [0,1), exactly.
+inline float _philox_u32_to_float(uint32_t x)
+{
+    return _philox_barrier(float(x >> 8) * (1.0f / 16777216.0f));
+}
+
+// 64 random bits -> [0,1), exactly (via the bit pattern of a double in [1,2)).
+inline double _philox_u64_to_double(uint64_t x)
+{
+    uint64_t b = (x >> 12) | 0x3ff0000000000000ULL;
+    double d;
+    memcpy(&d, &b, sizeof(d));
+    return _philox_barrier(d - 1.0);
+}
+
+
+#if defined(__AVX512F__)
+
+// gcc 12's avx512fintrin.h triggers spurious -Wmaybe-uninitialized warnings (gcc bug 105593).
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+// 32-bit lanes: hi/lo halves of the 64-bit products m*x.
+inline void _philox_mulhilo(__m512i m, __m512i x, __m512i &hi, __m512i &lo)
+{
+    __m512i pe = _mm512_mul_epu32(m, x);                          // even lanes
+    __m512i po = _mm512_mul_epu32(m, _mm512_srli_epi64(x, 32));   // odd lanes
+    lo = _mm512_mask_blend_epi32(0xaaaa, pe, _mm512_slli_epi64(po, 32));
+    hi = _mm512_mask_blend_epi32(0xaaaa, _mm512_srli_epi64(pe, 32), po);
+}
+
+// Generates 16 blocks, starting at rng.position (which is advanced).  On return, out[j] contains
+// blocks (4j, ..., 4j+3), in memory order.
+inline void _philox_generate_blocks(philox_rng &rng, __m512i out[4])
+{
+    alignas(64) uint32_t lo[16], hi[16];
+    for (int j = 0; j < 16; j++) {
+	lo[j] = uint32_t(rng.position + j);
+	hi[j] = uint32_t((rng.position + j) >> 32);
+    }
+
+    rng.position += 16;
+
+    // Structure-of-arrays: register i holds counter word i of all 16 blocks.
+    __m512i c0 = _mm512_load_si512(lo);
+    __m512i c1 = _mm512_load_si512(hi);
+    __m512i c2 = _mm512_set1_epi32(rng.stream[0]);
+    __m512i c3 = _mm512_set1_epi32(rng.stream[1]);
+    __m512i m0 = _mm512_set1_epi32(0xd2511f53);
+    __m512i m1 = _mm512_set1_epi32(0xcd9e8d57);
+    uint32_t k0 = rng.key[0], k1 = rng.key[1];
+
+    for (int r = 0; r < 10; r++) {
+	__m512i hi0, lo0, hi1, lo1;
+	_philox_mulhilo(m0, c0, hi0, lo0);
+	_philox_mulhilo(m1, c2, hi1, lo1);
+
+	c0 = _mm512_xor_si512(_mm512_xor_si512(hi1, c1), _mm512_set1_epi32(k0));
+	c1 = lo1;
+	c2 = _mm512_xor_si512(_mm512_xor_si512(hi0, c3), _mm512_set1_epi32(k1));
+	c3 = lo0;
+
+	k0 += 0x9e3779b9;
+	k1 += 0xbb67ae85;
+    }
+
+    // Transpose to array-of-structures.  Within 128-bit lanes, u_j = blocks (j, j+4, j+8, j+12).
+    __m512i t0 = _mm512_unpacklo_epi32(c0, c1);
+    __m512i t1 = _mm512_unpackhi_epi32(c0, c1);
+    __m512i t2 = _mm512_unpacklo_epi32(c2, c3);
+    __m512i t3 = _mm512_unpackhi_epi32(c2, c3);
+    __m512i u0 = _mm512_unpacklo_epi64(t0, t2);
+    __m512i u1 = _mm512_unpackhi_epi64(t0, t2);
+    __m512i u2 = _mm512_unpacklo_epi64(t1, t3);
+    __m512i u3 = _mm512_unpackhi_epi64(t1, t3);
+
+    __m512i v0 = _mm512_shuffle_i32x4(u0, u1, 0x44);   // blocks 0, 4, 1, 5
+    __m512i v1 = _mm512_shuffle_i32x4(u2, u3, 0x44);   // blocks 2, 6, 3, 7
+    __m512i v2 = _mm512_shuffle_i32x4(u0, u1, 0xee);   // blocks 8, 12, 9, 13
+    __m512i v3 = _mm512_shuffle_i32x4(u2, u3, 0xee);   // blocks 10, 14, 11, 15
+
+    out[0] = _mm512_shuffle_i32x4(v0, v1, 0x88);
+    out[1] = _mm512_shuffle_i32x4(v0, v1, 0xdd);
+    out[2] = _mm512_shuffle_i32x4(v2, v3, 0x88);
+    out[3] = _mm512_shuffle_i32x4(v2, v3, 0xdd);
+}
+
+#elif defined(__AVX2__)
+
+// 32-bit lanes: hi/lo halves of the 64-bit products m*x.
+inline void _philox_mulhilo(__m256i m, __m256i x, __m256i &hi, __m256i &lo)
+{
+    __m256i pe = _mm256_mul_epu32(m, x);                          // even lanes
+    __m256i po = _mm256_mul_epu32(m, _mm256_srli_epi64(x, 32));   // odd lanes
+    lo = _mm256_blend_epi32(pe, _mm256_slli_epi64(po, 32), 0xaa);
+    hi = _mm256_blend_epi32(_mm256_srli_epi64(pe, 32), po, 0xaa);
+}
+
+// Generates 8 blocks, starting at rng.position (which is advanced).  On return, out[j] contains
+// blocks (2j, 2j+1), in memory order.
+inline void _philox_generate_blocks(philox_rng &rng, __m256i out[4])
+{
+    alignas(32) uint32_t lo[8], hi[8];
+    for (int j = 0; j < 8; j++) {
+	lo[j] = uint32_t(rng.position + j);
+	hi[j] = uint32_t((rng.position + j) >> 32);
+    }
+
+    rng.position += 8;
+
+    // Structure-of-arrays: register i holds counter word i of all 8 blocks.
+    __m256i c0 = _mm256_load_si256((const __m256i *) lo);
+    __m256i c1 = _mm256_load_si256((const __m256i *) hi);
+    __m256i c2 = _mm256_set1_epi32(rng.stream[0]);
+    __m256i c3 = _mm256_set1_epi32(rng.stream[1]);
+    __m256i m0 = _mm256_set1_epi32(0xd2511f53);
+    __m256i m1 = _mm256_set1_epi32(0xcd9e8d57);
+    uint32_t k0 = rng.key[0], k1 = rng.key[1];
+
+    for (int r = 0; r < 10; r++) {
+	__m256i hi0, lo0, hi1, lo1;
+	_philox_mulhilo(m0, c0, hi0, lo0);
+	_philox_mulhilo(m1, c2, hi1, lo1);
+
+	c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32(k0));
+	c1 = lo1;
+	c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32(k1));
+	c3 = lo0;
+
+	k0 += 0x9e3779b9;
+	k1 += 0xbb67ae85;
+    }
+
+    // Transpose to array-of-structures.  Within 128-bit lanes, u_j = blocks (j, j+4).
+    __m256i t0 = _mm256_unpacklo_epi32(c0, c1);
+    __m256i t1 = _mm256_unpackhi_epi32(c0, c1);
+    __m256i t2 = _mm256_unpacklo_epi32(c2, c3);
+    __m256i t3 = _mm256_unpackhi_epi32(c2, c3);
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+    __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+    __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+
+    out[0] = _mm256_permute2x128_si256(u0, u1, 0x20);
+    out[1] = _mm256_permute2x128_si256(u2, u3, 0x20);
+    out[2] = _mm256_permute2x128_si256(u0, u1, 0x31);
+    out[3] = _mm256_permute2x128_si256(u2, u3, 0x31);
+}
+
+#endif
+
+
+inline void uniform_rand(philox_rng &rng, float *dst, ssize_t n, double lo=0.0, double hi=1.0)
+{
+    const float a = lo;
+    const float s = hi - lo;
+    ssize_t i = 0;
+
+#if defined(__AVX512F__)
+    for ( ; i + 64 <= n; i += 64) {
+	__m512i r[4];
+	_philox_generate_blocks(rng, r);
+
+	for (int j = 0; j < 4; j++) {
+	    __m512 u = _mm512_cvtepi32_ps(_mm512_srli_epi32(r[j], 8));
+	    u = _philox_barrier(_mm512_mul_ps(u, _mm512_set1_ps(1.0f / 16777216.0f)));
+	    __m512 t = _philox_barrier(_mm512_mul_ps(_mm512_set1_ps(s), u));
+	    _mm512_storeu_ps(dst + i + 16*j, _mm512_add_ps(_mm512_set1_ps(a), t));
+	}
+    }
+#elif defined(__AVX2__)
+    for ( ; i + 32 <= n; i += 32) {
+	__m256i r[4];
+	_philox_generate_blocks(rng, r);
+
+	for (int j = 0; j < 4; j++) {
+	    __m256 u = _mm256_cvtepi32_ps(_mm256_srli_epi32(r[j], 8));
+	    u = _philox_barrier(_mm256_mul_ps(u, _mm256_set1_ps(1.0f / 16777216.0f)));
+	    __m256 t = _philox_barrier(_mm256_mul_ps(_mm256_set1_ps(s), u));
+	    _mm256_storeu_ps(dst + i + 8*j, _mm256_add_ps(_mm256_set1_ps(a), t));
+	}
+    }
+#endif
+
+    // Remaining elements (or all elements, without AVX2), one block at a time.
+    for ( ; i < n; i += 4) {
+	uint32_t w[4];
+	rng.generate_block(rng.position++, w);
+
+	for (int j = 0; (j < 4) && (i+j < n); j++)
+	    dst[i+j] = a + _philox_barrier(s * _philox_u32_to_float(w[j]));
+    }
+}
+
+
+inline void uniform_rand(philox_rng &rng, double *dst, ssize_t n, double lo=0.0, double hi=1.0)
+{
+    const double s = hi - lo;
+    ssize_t i = 0;
+
+#if defined(__AVX512F__)
+    for ( ; i + 32 <= n; i += 32) {
+	__m512i r[4];
+	_philox_generate_blocks(rng, r);
+
+	for (int j = 0; j < 4; j++) {
+	    __m512i b = _mm512_or_si512(_mm512_srli_epi64(r[j], 12), _mm512_set1_epi64(0x3ff0000000000000LL));
+	    __m512d u = _philox_barrier(_mm512_sub_pd(_mm512_castsi512_pd(b), _mm512_set1_pd(1.0)));
+	    __m512d t = _philox_barrier(_mm512_mul_pd(_mm512_set1_pd(s), u));
+	    _mm512_storeu_pd(dst + i + 8*j, _mm512_add_pd(_mm512_set1_pd(lo), t));
+	}
+    }
+#elif defined(__AVX2__)
+    for ( ; i + 16 <= n; i += 16) {
+	__m256i r[4];
+	_philox_generate_blocks(rng, r);
+
+	for (int j = 0; j < 4; j++) {
+	    __m256i b = _mm256_or_si256(_mm256_srli_epi64(r[j], 12), _mm256_set1_epi64x(0x3ff0000000000000LL));
+	    __m256d u = _philox_barrier(_mm256_sub_pd(_mm256_castsi256_pd(b), _mm256_set1_pd(1.0)));
+	    __m256d t = _philox_barrier(_mm256_mul_pd(_mm256_set1_pd(s), u));
+	    _mm256_storeu_pd(dst + i + 4*j, _mm256_add_pd(_mm256_set1_pd(lo), t));
+	}
+    }
+#endif
+
+    for ( ; i < n; i += 2) {
+	uint32_t w[4];
+	rng.generate_block(rng.position++, w);
+
+	for (int j = 0; (j < 2) && (i+j < n); j++) {
+	    uint64_t x = (uint64_t(w[2*j+1]) << 32) | w[2*j];
+	    dst[i+j] = lo + _philox_barrier(s * _philox_u64_to_double(x));
+	}
+    }
+}
+
+
+template<typename T> inline void uniform_rand(philox_rng &rng, std::vector<T> &dst, double lo=0.0, double hi=1.0)
+{
+    uniform_rand(rng, dst.data(), dst.size(), lo, hi);
+}
+
+
+// Box-Muller, on uniforms from uniform_rand(rng, double *, ...).  Element pair (2k, 2k+1) uses
+// block (position + k), regardless of how the fill is split into chunks below.
+template<typename T> inline void _philox_gaussian_rand(philox_rng &rng, T *dst, ssize_t n, double rms)
+{
+    const ssize_t nbuf = 256;
+    double buf[nbuf];
+
+    for (ssize_t i = 0; i < n; i += nbuf) {
+	ssize_t m = std::min(nbuf, n-i);
+	uniform_rand(rng, buf, m + (m & 1));
+
+	for (ssize_t j = 0; j < m; j += 2) {
+	    // The barrier also keeps the compiler from vectorizing log/sin/cos (see above).
+	    double r = _philox_barrier(rms * sqrt(-2.0 * log(1.0 - buf[j])));
+	    double theta = 2.0 * M_PI * buf[j+1];
+
+	    dst[i+j] = r * cos(theta);
+	    if (j+1 < m)
+		dst[i+j+1] = r * sin(theta);
+	}
+    }
+}
+
+inline void gaussian_rand(philox_rng &rng, float *dst, ssize_t n, double rms=1.0)
+{
+    _philox_gaussian_rand(rng, dst, n, rms);
+}
+
+inline void gaussian_rand(philox_rng &rng, double *dst, ssize_t n, double rms=1.0)
+{
+    _philox_gaussian_rand(rng, dst, n, rms);
+}
+
+template<typename T> inline void gaussian_rand(philox_rng &rng, std::vector<T> &dst, double rms=1.0)
+{
+    gaussian_rand(rng, dst.data(), dst.size(), rms);
+}
+
+#if defined(__AVX512F__)
+#pragma GCC diagnostic pop
+#endif
+
+
 // -------------------------------------------------------------------------------------------------
 //
 // Integer distributions
@@ -107,10 +482,10 @@ inline int randint(std::mt19937 &rng, int lo, int hi)
 
 
 template<typename T>
-inline void randomly_permute(std::mt19937 &rng, T *v, int n)
+inline void randomly_permute(std::mt19937 &rng, T *v, ssize_t n)
 {
-    for (int i = 1; i < n; i++) {
-	int j = randint(rng, 0, i+1);
+    for (ssize_t i = 1; i < n; i++) {
+	ssize_t j = std::uniform_int_distribution<ssize_t>(0,i)(rng);
 	std::swap(v[i], v[j]);
     }
 }
@@ -119,7 +494,7 @@ inline void randomly_permute(std::mt19937 &rng, T *v, int n)
 template<typename T> 
 inline void randomly_permute(std::mt19937 &rng, std::vector<T> &v)
 {
-    randomly_permute(&v[0], v.size());
+    randomly_permute(rng, &v[0], v.size());
 }
 
 
@@ -0,0 +1,232 @@
+// Suite runner for registered benchmarks (see benchmark_registry.hpp).
+//
+// Usage: run-benchmarks [-l] [-b patterns] [-t nthreads,...] [-p pinning,...] [-n ntrials] [-m mib]
+//                       [-B barrier] [-u] [-i] [-y paramfile.yaml] [-f json|csv] [-o filename]
+//                       [-c baseline.json] [-r threshold] [-a alpha] [-T trace.json]
+//
+//   -l  list registered benchmarks and exit
+//   -b  comma-separated shell-style patterns (default "*"), e.g. "memory/*,sync/barrier"
+//   -t  comma-separated thread counts (default 1); every benchmark is run at each
+//   -p  comma-separated pinning policies (default sequential)
+//   -n  trials per benchmark (default 10)
+//   -m  per-thread working set in MiB, for benchmarks which use one (default 64)
+//   -B  barrier type: mutex, spin or hybrid (default mutex)
+//   -u  don't pin threads
+//   -i  monitor cpufreq/throttling/interrupts/context switches around each trial, and count
+//       trials with significant interference ("ninterference" in the output)
+//   -y  yaml paramfile, with any of the keys: benchmarks, nthreads, pinning, ntrials, nbytes_mib,
+//       barrier, pin, monitor_interference, format, output, baseline, threshold, alpha (command-line flags take precedence)
+//   -f  output format (default json)
+//   -o  output file (default stdout)
+//   -c  compare against a baseline (JSON output from a previous run, see benchmark_compare.hpp)
+//   -r  regression threshold, as a fraction of the baseline median (default 0.05)
+//   -a  significance level for the Mann-Whitney test (default 0.01)
+//   -T  write a timeline trace of all benchmark threads, in Chrome trace JSON (see trace.hpp)
+//
+// Progress messages and the baseline comparison go to stderr.  The exit status is 2 if any
+// regressions were found, so that a cron job can gate on it.
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include "argument_parser.hpp"
+#include "benchmark_registry.hpp"
+#include "benchmark_compare.hpp"
+#include "yaml_paramfile.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+
+static vector<string> split_commas(const string &s)
+{
+    vector<string> ret;
+    stringstream ss(s);
+    string t;
+
+    while (getline(ss, t, ','))
+	if (t.size() > 0)
+	    ret.push_back(t);
+
+    return ret;
+}
+
+
+static barrier_type barrier_type_from_string(const string &s)
+{
+    if (s == "mutex")
+	return BARRIER_MUTEX;
+    if (s == "spin")
+	return BARRIER_SPIN;
+    if (s == "hybrid")
+	return BARRIER_HYBRID;
+    throw runtime_error("run-benchmarks: unrecognized barrier type '" + s + "' (expected mutex, spin or hybrid)");
+}
+
+
+static void usage()
+{
+    cerr << "usage: run-benchmarks [-l] [-b patterns] [-t nthreads,...] [-p pinning,...] [-n ntrials] [-m mib]\n"
+	 << "                      [-B barrier] [-u] [-i] [-y paramfile.yaml] [-f json|csv] [-o filename]\n"
+	 << "                      [-c baseline.json] [-r threshold] [-a alpha] [-T trace.json]" << endl;
+    exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+    bool list = false;
+    bool unpinned = false;
+    bool monitor = false;
+    string patterns = "*";
+    string nthreads_list = "1";
+    string pinning_list = "sequential";
+    int ntrials = 10;
+    int nbytes_mib = 64;
+    string barrier = "mutex";
+    string paramfile;
+    string format = "json";
+    string output;
+    string baseline;
+    double threshold = 0.05;
+    double alpha = 0.01;
+    string trace_filename;
+
+    bool bflag, tflag, pflag, nflag, mflag, Bflag, yflag, fflag, oflag, cflag, rflag, aflag;
+
+    argument_parser parser;
+    parser.add_boolean_flag("-l", list);
+    parser.add_boolean_flag("-u", unpinned);
+    parser.add_boolean_flag("-i", monitor);
+    parser.add_flag_with_parameter("-b", patterns, bflag);
+    parser.add_flag_with_parameter("-t", nthreads_list, tflag);
+    parser.add_flag_with_parameter("-p", pinning_list, pflag);
+    parser.add_flag_with_parameter("-n", ntrials, nflag);
+    parser.add_flag_with_parameter("-m", nbytes_mib, mflag);
+    parser.add_flag_with_parameter("-B", barrier, Bflag);
+    parser.add_flag_with_parameter("-y", paramfile, yflag);
+    parser.add_flag_with_parameter("-f", format, fflag);
+    parser.add_flag_with_parameter("-o", output, oflag);
+    parser.add_flag_with_parameter("-c", baseline, cflag);
+    parser.add_flag_with_parameter("-r", threshold, rflag);
+    parser.add_flag_with_parameter("-a", alpha, aflag);
+    parser.add_flag_with_parameter("-T", trace_filename);
+
+    if (!parser.parse_args(argc, argv) || (parser.nargs > 0))
+	usage();
+
+    if (list) {
+	for (const benchmark_info &b: get_benchmark_registry())
+	    cout << b.name << ": " << b.description << endl;
+	return 0;
+    }
+
+    if (yflag) {
+	yaml_paramfile p(paramfile);
+
+	// Lists are re-joined with commas, so that the yaml file and command line are parsed the same way.
+	auto join = [](const vector<string> &v) { string s; for (const string &x: v) s += (s.size() ? "," : "") + x; return s; };
+
+	if (!bflag)
+	    patterns = join(p.read_vector<string> ("benchmarks", { patterns }));
+	if (!tflag)
+	    nthreads_list = join(p.read_vector<string> ("nthreads", { nthreads_list }));
+	if (!pflag)
+	    pinning_list = join(p.read_vector<string> ("pinning", { pinning_list }));
+	if (!nflag)
+	    ntrials = p.read_scalar<int> ("ntrials", ntrials);
+	if (!mflag)
+	    nbytes_mib = p.read_scalar<int> ("nbytes_mib", nbytes_mib);
+	if (!Bflag)
+	    barrier = p.read_scalar<string> ("barrier", barrier);
+	if (!unpinned)
+	    unpinned = !p.read_scalar<bool> ("pin", true);
+	if (!monitor)
+	    monitor = p.read_scalar<bool> ("monitor_interference", false);
+	if (!fflag)
+	    format = p.read_scalar<string> ("format", format);
+	if (!oflag)
+	    output = p.read_scalar<string> ("output", output);
+	if (!cflag)
+	    baseline = p.read_scalar<string> ("baseline", baseline);
+	if (!rflag)
+	    threshold = p.read_scalar<double> ("threshold", threshold);
+	if (!aflag)
+	    alpha = p.read_scalar<double> ("alpha", alpha);
+
+	p.check_for_unused_params();
+    }
+
+    if ((format != "json") && (format != "csv"))
+	usage();
+    if ((ntrials < 1) || (nbytes_mib < 1) || (threshold < 0.0) || (alpha <= 0.0))
+	usage();
+
+    // Read the baseline before running anything, so that a bad filename fails fast.
+    vector<benchmark_result> baseline_results;
+    if (baseline.size() > 0)
+	baseline_results = read_results_json(baseline);
+
+    vector<benchmark_info> benchmarks = match_benchmarks(patterns);
+    if (benchmarks.size() == 0) {
+	cerr << "run-benchmarks: no benchmarks match '" << patterns << "' (use -l to list)" << endl;
+	usage();
+    }
+
+    benchmark_params params;
+    params.ntrials = ntrials;
+    params.nbytes = ssize_t(nbytes_mib) << 20;
+    params.barrier = barrier_type_from_string(barrier);
+    params.pin_to_core = !unpinned;
+    params.monitor_interference = monitor;
+
+    if (trace_filename.size() > 0)
+	start_tracing();
+
+    vector<benchmark_result> results;
+
+    for (const string &p: split_commas(pinning_list)) {
+	for (const string &t: split_commas(nthreads_list)) {
+	    params.pinning = pinning_policy_from_string(p);
+	    params.nthreads = lexical_cast<int> (t, "nthreads");
+
+	    for (const benchmark_info &b: benchmarks) {
+		cerr << "running " << b.name << " (nthreads=" << params.nthreads << ", pinning=" << p << ")" << endl;
+		vector<benchmark_result> v = run_benchmark(b, params);
+		results.insert(results.end(), v.begin(), v.end());
+
+		for (const benchmark_result &r: v)
+		    if (r.ninterference > 0)
+			cerr << "warning: " << b.name << "/" << r.name << ": " << r.ninterference << "/" << r.stats.ntrials << " trials flagged for interference" << endl;
+	    }
+	}
+    }
+
+    if (trace_filename.size() > 0) {
+	stop_tracing();
+	write_trace_json(trace_filename);
+    }
+
+    ofstream f;
+    if (output.size() > 0) {
+	f.open(output);
+	if (!f)
+	    throw runtime_error("run-benchmarks: couldn't open output file '" + output + "'");
+    }
+
+    ostream &os = (output.size() > 0) ? f : cout;
+
+    if (format == "json")
+	write_results_json(os, results);
+    else
+	write_results_csv(os, results);
+
+    if (baseline.size() > 0) {
+	vector<benchmark_comparison> v = compare_results(baseline_results, results, threshold, alpha);
+	if (print_comparison(v, cerr) > 0)
+	    return 2;
+    }
+
+    return 0;
+}
@@ -1,7 +1,38 @@
+#include <cmath>
 #include <cassert>
+#include <unistd.h>
+#include <thread>
+#include <array>
+#include <vector>
+#include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+
+#ifdef __linux__
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#endif
 
 #include "lexical_cast.hpp"
+#include "buffer_pool.hpp"
+#include "memory_arena.hpp"
+#include "memory_utils.hpp"
+#include "strided_array.hpp"
+#include "random.hpp"
+#include "task_pool.hpp"
+#include "parallel_for.hpp"
+#include "timing_thread.hpp"
+#include "trace.hpp"
+#include "profiler.hpp"
+#include "scaling_sweep.hpp"
+#include "benchmark_registry.hpp"
+#include "benchmark_compare.hpp"
 #include "arithmetic_inlines.hpp"
 
 using namespace std;
@@ -25,9 +56,1140 @@ static void test_round_up_to_power_of_two()
 }
 
 
+static void test_aligned_allocator()
+{
+    std::vector<float, aligned_allocator<float>> v(1000, 1.0);
+    assert(is_aligned(&v[0], 128));
+
+    for (hugepage_mode mode: { HUGEPAGES_TRANSPARENT, HUGEPAGES_HUGETLB }) {
+	aligned_allocator<double> a(mode);
+	ssize_t n = 3 * hugepage_size / sizeof(double) + 5;
+
+	std::vector<double, aligned_allocator<double>> w(n, 2.0, a);
+	assert(is_aligned(&w[0], hugepage_size));
+	assert(w[0] == 2.0 && w[n-1] == 2.0);
+
+	w.resize(2*n, 3.0);   // reallocation goes through deallocate()
+	assert(w[n-1] == 2.0 && w[2*n-1] == 3.0);
+    }
+
+    cout << "test_aligned_allocator: pass" << endl;
+}
+
+
+static void test_parallel_first_touch()
+{
+    ssize_t n = 1000 * 1000 + 17;
+
+    for (numa_policy policy: { NUMA_LOCAL, NUMA_INTERLEAVE, NUMA_BLOCKED }) {
+	uptr<int> p = make_uptr_numa<int> (n, { 0, 0, 0 }, policy);
+	for (ssize_t i = 0; i < n; i++)
+	    assert(p[i] == 0);
+
+	// Pre-faulting without zeroing must preserve contents.
+	for (ssize_t i = 0; i < n; i++)
+	    p[i] = i;
+	parallel_first_touch(p.get() + 1, (n-1) * sizeof(int), { 0, 0 }, policy, false);
+	for (ssize_t i = 0; i < n; i++)
+	    assert(p[i] == i);
+    }
+
+    cout << "test_parallel_first_touch: pass" << endl;
+}
+
+
+static void test_buffer_pool()
+{
+    auto pool = buffer_pool::make(4096, 4);
+
+    {
+	pool_uptr<int> p = pool->get_uptr<int> ();
+	std::shared_ptr<int[]> q = pool->get_sptr<int> ();
+	assert(is_aligned(p.get(), 128));
+	assert(p[0] == 0 && p[1023] == 0);
+	assert(pool->num_in_use() == 2);
+    }
+
+    assert(pool->num_in_use() == 0);
+    assert(pool->high_water_mark() == 2);
+
+    // Hammer the free list from several threads; with 8 threads and 4 buffers, some must block.
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; i++) {
+	threads.push_back(std::thread([pool,i]() {
+	    for (int j = 0; j < 2000; j++) {
+		pool_uptr<int> p = pool->get_uptr<int> ();
+		p[0] = i;
+		p[1023] = i;
+		assert(p[0] == p[1023]);
+	    }
+	}));
+    }
+    for (auto &t: threads)
+	t.join();
+
+    assert(pool->num_in_use() == 0);
+    assert(pool->high_water_mark() <= 4);
+    assert(pool->num_hits() + pool->num_misses() == 2 + 8 * 2000);
+
+    auto gpool = buffer_pool::make(1024, 1, POOL_GROW, 2);
+    auto g1 = gpool->get_uptr<char> ();
+    auto g2 = gpool->get_uptr<char> ();
+    assert(gpool->num_allocated() == 2 && gpool->num_misses() == 1);
+
+    auto tpool = buffer_pool::make(1024, 1, POOL_THROW);
+    auto t1 = tpool->get_uptr<char> ();
+    bool thrown = false;
+    try {
+	tpool->get_uptr<char> ();
+    } catch (std::runtime_error &) {
+	thrown = true;
+    }
+    assert(thrown);
+
+#ifdef __linux__
+    // Pre-faulted even if not zeroed: every page is resident.  (The buffer is larger than glibc's
+    // maximum mmap threshold, so that it comes from fresh mmap() pages, not recycled heap memory.)
+    const size_t nb = 64 << 20;
+    auto npool = buffer_pool::make(nb, 1, POOL_BLOCK, 0, 4096, false);
+    auto n1 = npool->get_uptr<char> ();
+    std::vector<unsigned char> resident(nb / 4096);
+    assert(mincore(n1.get(), nb, &resident[0]) == 0);
+    for (unsigned char r: resident)
+	assert(r & 1);
+#endif
+
+    cout << "test_buffer_pool: pass" << endl;
+}
+
+
+static void test_memory_arena()
+{
+    memory_arena arena(1 << 20, true);   // debug=true
+
+    for (int iter = 0; iter < 3; iter++) {
+	size_t m = arena.mark();
+	float *a = arena.alloc<float> (1000, 128, true);
+	char *b = arena.alloc<char> (3);
+	double *c = arena.alloc<double> (7);
+
+	assert(is_aligned(a, 128) && is_aligned(b, 64) && is_aligned(c, 64));
+	assert(a[0] == 0.0 && a[999] == 0.0);
+
+	memset(b, 1, 3);
+	arena.check_guards();
+	arena.reset(m);
+	assert(arena.nbytes_used() == m);
+    }
+
+    size_t peak = arena.peak_nbytes_used();
+    assert(peak > 4000 && peak < 8192);
+
+    // Writing past the end of an array should be caught by the guard check.
+    char *d = arena.alloc<char> (10);
+    d[10] = 0;
+    bool thrown = false;
+    try {
+	arena.reset();
+    } catch (std::runtime_error &) {
+	thrown = true;
+    }
+    assert(thrown);
+
+    // Capacity overflow.
+    thrown = false;
+    try {
+	arena.alloc<char> (2 << 20);
+    } catch (std::runtime_error &) {
+	thrown = true;
+    }
+    assert(thrown);
+
+    cout << "test_memory_arena: pass" << endl;
+}
+
+
+static void test_memory_accounting()
+{
+    {
+	memory_tag_scope t("test_memory_accounting");
+	uptr<char> p = make_uptr<char> (1000);
+	uptr<char> q = make_uptr<char> (3000, 4096);
+	assert(is_aligned(q.get(), 4096));
+	p.reset();
+
+	// Counts from a thread which has exited (and whose per-thread counters were retired) are kept.
+	std::thread([]() {
+	    memory_tag_scope t2("test_memory_accounting");
+	    make_uptr<char> (500);
+	}).join();
+
+#ifdef MEMORY_ACCOUNTING
+	bool found = false;
+	for (const memory_accounting_stats &m: get_memory_accounting_stats()) {
+	    if (m.tag != "test_memory_accounting")
+		continue;
+	    assert(m.nalloc == 3 && m.nfree == 2);
+	    assert(m.live_nbytes == 3000 && m.peak_nbytes == 4000 && m.total_nbytes == 4500);
+	    found = true;
+	}
+	assert(found);
+#endif
+    }
+
+    assert(get_resident_memory() > 0);
+    assert(get_physical_memory() >= get_resident_memory());
+
+    cout << "test_memory_accounting: pass" << endl;
+}
+
+
+static void test_strided_array()
+{
+    strided_array<float,3> a(3, 5, 7);
+    assert(a.strides[2] == 1 && a.strides[1] == 16 && a.strides[0] == 80);
+    assert(a.size() == 105 && a(2,4,6) == 0.0);
+
+    for (int i = 0; i < 3; i++)
+	for (int j = 0; j < 5; j++)
+	    for (int k = 0; k < 7; k++)
+		a(i,j,k) = 100*i + 10*j + k;
+
+    for (int i = 0; i < 3; i++)
+	for (int j = 0; j < 5; j++)
+	    assert(is_aligned(&a(i,j,0), 64));
+
+    strided_array_view<float,2> b = a[2];
+    strided_array_view<float,1> c = a[1][3];
+    strided_array_view<float,3> d = a.range(1, 2, 4);
+    assert(b(3,4) == 234 && c[5] == 135 && b[1][2] == 212);
+    assert(d.shape[1] == 2 && d(1,1,6) == 136);
+
+    // A 4 KB row is padded by one cache line, to avoid cache-set aliasing.
+    strided_array<float,2> e(4, 1024);
+    assert(e.strides[0] == 1024 + 16);
+
+    strided_array<float,2> f({ 4, 1024 }, strided_array_padding(32, 0));
+    assert(f.strides[0] == 1024);
+
+    cout << "test_strided_array: pass" << endl;
+}
+
+
+static void test_philox()
+{
+    // Known-answer tests, from the Random123 distribution (kat_vectors).
+    uint32_t ctr0[4] = { 0, 0, 0, 0 };
+    uint32_t key0[2] = { 0, 0 };
+    uint32_t ctr1[4] = { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 };
+    uint32_t key1[2] = { 0xa4093822, 0x299f31d0 };
+    uint32_t out[4];
+
+    philox_rng::philox4x32_10(ctr0, key0, out);
+    assert((out[0] == 0x6627e8d5) && (out[1] == 0xe169c58d) && (out[2] == 0xbc57ac4c) && (out[3] == 0x9b00dbd8));
+
+    philox_rng::philox4x32_10(ctr1, key1, out);
+    assert((out[0] == 0xd16cfe09) && (out[1] == 0x94fdcceb) && (out[2] == 0x5001e420) && (out[3] == 0x24126ea1));
+
+    // Bulk fills (vectorized if compiled with AVX2/AVX-512) agree bitwise with a scalar reference.
+    // The starting position crosses a 2^32 boundary in the block index.
+    for (int n: { 1, 7, 64, 203, 1000 }) {
+	philox_rng rng(12345, 3);
+	rng.position = 0xfffffff0ULL;
+
+	vector<float> f(n);
+	vector<double> d(n);
+	uniform_rand(rng, f, -2.5, 7.0);
+	uniform_rand(rng, d, -2.5, 7.0);
+	assert(rng.position == 0xfffffff0ULL + (n+3)/4 + (n+1)/2);
+
+	philox_rng ref(12345, 3);
+	uint64_t fpos = 0xfffffff0ULL;
+	uint64_t dpos = fpos + (n+3)/4;
+
+	for (int i = 0; i < n; i++) {
+	    uint32_t w[4];
+	    ref.generate_block(fpos + i/4, w);
+	    assert(f[i] == float(-2.5) + _philox_barrier(float(9.5) * _philox_u32_to_float(w[i%4])));
+	    assert((f[i] >= -2.5) && (f[i] <= 7.0));
+
+	    ref.generate_block(dpos + i/2, w);
+	    uint64_t x = (uint64_t(w[2*(i%2)+1]) << 32) | w[2*(i%2)];
+	    assert(d[i] == -2.5 + _philox_barrier(9.5 * _philox_u64_to_double(x)));
+	    assert((d[i] >= -2.5) && (d[i] < 7.0));
+	}
+    }
+
+    // Splitting a fill on block boundaries doesn't change the output; streams are independent.
+    philox_rng r1(7), r2(7), r3(7, 1);
+    vector<float> f1(256), f2(256), f3(256);
+    uniform_rand(r1, f1);
+    uniform_rand(r2, &f2[0], 100);
+    uniform_rand(r2, &f2[100], 156);
+    uniform_rand(r3, f3);
+    assert(f1 == f2);
+    assert(f1 != f3);
+
+    // Gaussian moments (with 10^5 samples, statistical errors are ~0.01).
+    vector<double> g(100000);
+    gaussian_rand(r1, g, 2.0);
+
+    double s1 = 0.0, s2 = 0.0;
+    for (double x: g) {
+	s1 += x;
+	s2 += x*x;
+    }
+
+    assert(fabs(s1 / g.size()) < 0.05);
+    assert(fabs(sqrt(s2 / g.size()) - 2.0) < 0.05);
+
+    // Empty fills are no-ops.
+    vector<float> e;
+    uint64_t pos = r1.position;
+    uniform_rand(r1, e);
+    gaussian_rand(r1, e);
+    assert(r1.position == pos);
+
+    cout << "test_philox: pass" << endl;
+}
+
+
+static void test_timing_statistics()
+{
+    std::vector<double> v;
+    for (int i = 100; i >= 1; i--)
+	v.push_back(i);
+
+    timing_statistics s = compute_timing_statistics(v);
+    assert(s.ntrials == 100 && s.min == 1.0 && s.median == 50.5 && s.p99 == 99.0 && s.mean == 50.5);
+    assert(fabs(s.stddev - 29.011491975882016) < 1.0e-10);
+
+    timing_thread_pool pool(1, TIMER_TSC);
+    int64_t t0 = pool.get_ticks();
+    usleep(10000);
+    double dt = (pool.get_ticks() - t0) * pool.seconds_per_tick();
+    assert(dt > 0.009 && dt < 1.0);
+
+    cout << "test_timing_statistics: pass" << endl;
+}
+
+
+static void test_barriers()
+{
+    for (barrier_type b: { BARRIER_MUTEX, BARRIER_SPIN, BARRIER_HYBRID }) {
+	const int nthreads = 4;
+	const int niter = 20;
+	timing_thread_pool pool(nthreads, TIMER_MONOTONIC, b);
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < nthreads; i++) {
+	    threads.push_back(std::thread([&pool,i]() {
+		for (int j = 0; j < niter; j++) {
+		    double t = pool.wait_at_barrier(i + j);
+		    assert(t == 1.5 + j);
+		}
+
+		// Reverse thread_id order, so that argmax isn't just the arrival index.
+		for (int j = 0; j < niter; j++) {
+		    const barrier_reduction &r = pool.reduce_at_barrier(i * j, nthreads-1-i);
+		    assert((r.mean == 1.5 * j) && (r.max == 3 * j) && (r.min == 0));
+		    assert((j == 0) || ((r.argmax == 0) && (r.argmin == nthreads-1)));
+		    assert(r.tvals.size() == nthreads && r.tvals[nthreads-1-i] == i * j);
+		}
+	    }));
+	}
+	for (auto &t: threads)
+	    t.join();
+
+	assert(pool.get_barrier_skew().nbarriers == 2*niter-1);
+    }
+
+    cout << "test_barriers: pass" << endl;
+}
+
+
+struct allreduce_test_argmin {
+    double val;
+    int thread_id;
+};
+
+
+static void test_tree_allreduce()
+{
+    // Fake topology: 2 packages x 4 cores x 2 SMT siblings, with threads assigned round-robin over
+    // packages (so that the tree doesn't follow thread_id order).
+    const int nthreads = 16;
+    std::vector<cpu_info> thread_cpus(nthreads);
+    for (int i = 0; i < nthreads; i++) {
+	thread_cpus[i].package = i % 2;
+	thread_cpus[i].core = (i/2) % 4;
+    }
+
+    // 8 core nodes, 2 package nodes, root.
+    tree_allreduce<long> t8(thread_cpus, 8);
+    assert(t8.num_nodes() == 11 && t8.depth() == 3);
+
+    // Packages are split into subtrees: 8 core nodes, 2x3 package nodes, root.
+    tree_allreduce<long> t2(thread_cpus, 2);
+    assert(t2.num_nodes() == 15 && t2.depth() == 4);
+
+    timing_thread_pool pool(1);
+    tree_allreduce<long> t1(pool);
+    assert(t1.num_nodes() == 1 && t1.depth() == 1);
+    assert(t1.allreduce(0, 7, allreduce_sum()) == 7);
+
+    tree_allreduce<std::array<double,3>> ta(thread_cpus, 3);
+    tree_allreduce<allreduce_test_argmin> tm(thread_cpus, 4);
+    auto argmin = [](const allreduce_test_argmin &x, const allreduce_test_argmin &y) { return (y.val < x.val) ? y : x; };
+
+    const int niter = 50;
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < nthreads; i++) {
+	threads.push_back(std::thread([&,i]() {
+	    for (int j = 0; j < niter; j++) {
+		assert(t2.allreduce(i, i+j, allreduce_sum()) == (nthreads*(nthreads-1))/2 + nthreads*j);
+
+		std::array<double,3> x = {{ double(i), double(-i), double(j) }};
+		std::array<double,3> y = ta.allreduce(i, x, allreduce_max());
+		assert((y[0] == nthreads-1) && (y[1] == 0) && (y[2] == j));
+
+		allreduce_test_argmin m = tm.allreduce(i, { double((i+j) % nthreads), i }, argmin);
+		assert((m.val == 0) && (m.thread_id == (nthreads - j % nthreads) % nthreads));
+	    }
+	}));
+    }
+    for (auto &t: threads)
+	t.join();
+
+    cout << "test_tree_allreduce: pass" << endl;
+}
+
+
+static void test_pinning()
+{
+    const cpu_topology &topo = get_cpu_topology();
+    int ncpus = topo.cpus.size();
+    assert(ncpus > 0 && topo.nphysical_cores > 0 && topo.nphysical_cores <= ncpus);
+    assert(topo.npackages > 0 && topo.nnodes > 0);
+
+    for (pinning_policy p: { PIN_SEQUENTIAL, PIN_COMPACT, PIN_SCATTER, PIN_PHYSICAL_CORES }) {
+	assert(pinning_policy_from_string(pinning_policy_name(p)) == p);
+
+	int nthreads = (p == PIN_PHYSICAL_CORES) ? topo.nphysical_cores : (2 * ncpus + 1);
+	std::vector<int> v = get_pinning(p, nthreads);
+	assert((int)v.size() == nthreads);
+
+	// Each allowed cpu is used at most once before wrapping around.
+	std::vector<int> u(v.begin(), v.begin() + std::min(nthreads, ncpus));
+	std::sort(u.begin(), u.end());
+	assert(std::unique(u.begin(), u.end()) == u.end());
+
+	for (int cpu: v) {
+	    bool found = false;
+	    for (const cpu_info &c: topo.cpus)
+		found = found || (c.cpu == cpu);
+	    assert(found);
+	}
+    }
+
+    int cpu0 = topo.cpus[0].cpu;
+    assert(get_pinning(PIN_EXPLICIT, 2, { cpu0, cpu0, cpu0 }) == std::vector<int> ({ cpu0, cpu0 }));
+
+    bool thrown = false;
+    try {
+	get_pinning(PIN_PHYSICAL_CORES, topo.nphysical_cores + 1);
+    } catch (std::runtime_error &) {
+	thrown = true;
+    }
+    assert(thrown);
+
+    cout << "test_pinning: pass" << endl;
+}
+
+
+static void test_warm_up_cpu()
+{
+    // With a short time cap, warm_up_cpu() returns promptly whether or not the clock rate settles
+    // (it won't always settle on a busy or virtualized machine).  The overshoot is at most ~one 2 ms chunk.
+    warm_up_result r = warm_up_cpu(0.01, 0.1);
+
+    assert(r.elapsed > 0.0 && r.elapsed < 0.2);
+    assert(r.ghz > 0.0);
+    assert(r.cpufreq_ghz >= 0.0);
+    assert(!r.converged || (r.elapsed <= 0.1));
+
+    cout << "test_warm_up_cpu: pass" << endl;
+}
+
+
+static long task_pool_fib(task_pool &pool, int n)
+{
+    if (n < 12)
+	return (n < 2) ? n : (task_pool_fib(pool, n-1) + task_pool_fib(pool, n-2));
+
+    std::future<long> f = pool.submit([&pool,n]() { return task_pool_fib(pool, n-1); });
+    long x = task_pool_fib(pool, n-2);
+    return x + pool.wait(f);
+}
+
+
+static void test_task_pool()
+{
+    task_pool pool(4, PIN_SEQUENTIAL, std::vector<int> (), false);   // pin=false
+
+    // Nested tasks (exercises work stealing and task_pool::wait() from inside tasks).
+    std::future<long> f = pool.submit([&pool]() { return task_pool_fib(pool, 25); });
+    assert(pool.wait(f) == 75025);
+
+    // Many small tasks from outside the pool.
+    std::atomic<int> count(0);
+    for (int i = 0; i < 10000; i++)
+	pool.submit([&count]() { count++; });
+    pool.wait_all();
+    assert(count.load() == 10000);
+
+    // Exceptions propagate through futures.
+    std::future<void> g = pool.submit([]() { throw std::runtime_error("expected"); });
+    bool thrown = false;
+    try {
+	pool.wait(g);
+    } catch (std::runtime_error &) {
+	thrown = true;
+    }
+    assert(thrown);
+
+    cout << "test_task_pool: pass" << endl;
+}
+
+
+// Dropping the last reference to a pool from one of its own tasks aborts with an error message.
+// Runs in a child process (whose stderr is sent to a pipe), so it must be called before any other
+// threads exist: after fork(), the child may only allocate and create threads if the parent was
+// single-threaded.
+static void test_task_pool_destroyed_from_worker()
+{
+#ifdef __linux__
+    int fds[2];
+    assert(pipe(fds) == 0);
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+
+    if (pid == 0) {
+	close(fds[0]);
+	dup2(fds[1], 2);
+
+	auto p = make_shared<task_pool> (1, PIN_SEQUENTIAL, std::vector<int> (), false);
+	p->submit([p]() mutable { usleep(10000); p.reset(); });
+	p.reset();
+
+	// The worker aborts the process ~10 ms from now.  Only reached if it doesn't.
+	sleep(5);
+	_exit(0);
+    }
+
+    close(fds[1]);
+
+    string msg;
+    char buf[256];
+    for (ssize_t n; (n = read(fds[0], buf, sizeof(buf))) > 0; )
+	msg.append(buf, n);
+    close(fds[0]);
+
+    int status = 0;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFSIGNALED(status) && (WTERMSIG(status) == SIGABRT));
+    assert(msg.find("task_pool destroyed from one of its own worker threads") != string::npos);
+
+    cout << "test_task_pool_destroyed_from_worker: pass" << endl;
+#endif
+}
+
+
+static void test_parallel_for()
+{
+    task_pool pool(3, PIN_SEQUENTIAL, std::vector<int> (), false);   // pin=false
+    const ssize_t n = 100003;
+
+    uptr<int> x = make_uptr_for_pool<int> (pool, n);
+
+    for (parallel_schedule sched: { SCHEDULE_STATIC, SCHEDULE_DYNAMIC, SCHEDULE_GUIDED }) {
+	for (ssize_t chunk: { 0, 1, 1000 }) {
+	    parallel_for(pool, 0, n, [&x](ssize_t i) { x[i]++; }, sched, chunk);
+
+	    long s = parallel_reduce(pool, 10, n, 0L,
+				     [&x](ssize_t i, long &acc) { acc += i * x[i]; },
+				     [](long a, long b) { return a + b; },
+				     sched, chunk);
+
+	    assert(s == x[0] * ((n * (n-1)) / 2 - 45));
+	}
+    }
+
+    assert(x[0] == 9 && x[n-1] == 9);
+
+    // Nested: parallel_for() called from inside a task.
+    std::future<long> f = pool.submit([&pool]() {
+	return parallel_reduce(pool, 0, 1000, 0L, [](ssize_t i, long &acc) { acc += i; }, [](long a, long b) { return a + b; });
+    });
+    assert(pool.wait(f) == 499500);
+
+    cout << "test_parallel_for: pass" << endl;
+}
+
+
+static int count_substrings(const string &s, const string &t)
+{
+    int n = 0;
+    for (size_t pos = s.find(t); pos != string::npos; pos = s.find(t, pos+1))
+	n++;
+    return n;
+}
+
+
+static void test_trace()
+{
+    start_tracing();
+
+    // 3000 iterations x 3 events crosses a 4096-event chunk.
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 3; i++) {
+	threads.push_back(std::thread([i]() {
+	    set_trace_thread_name("test_trace " + to_string(i));
+	    for (int j = 0; j < 3000; j++) {
+		TRACE_SCOPE("test_trace scope");
+		TRACE_INSTANT(trace_intern("test_trace instant"));
+	    }
+	}));
+    }
+    for (auto &t: threads)
+	t.join();
+
+    stop_tracing();
+    TRACE_INSTANT("test_trace stopped");
+
+    stringstream ss;
+    write_trace_json(ss);
+    string s = ss.str();
+
+#ifndef NO_TRACING
+    assert(count_substrings(s, "\"name\": \"test_trace scope\", \"ph\": \"B\"") == 9000);
+    assert(count_substrings(s, "\"name\": \"test_trace scope\", \"ph\": \"E\"") == 9000);
+    assert(count_substrings(s, "\"name\": \"test_trace instant\", \"ph\": \"i\"") == 9000);
+    assert(count_substrings(s, "\"args\": { \"name\": \"test_trace ") == 3);
+    assert(count_substrings(s, "test_trace stopped") == 0);
+#endif
+
+    clear_trace();
+    ss.str("");
+    write_trace_json(ss);
+    assert(count_substrings(ss.str(), "test_trace scope") == 0);
+
+    cout << "test_trace: pass" << endl;
+}
+
+
+static void test_profiler()
+{
+    const int nthreads = 2;
+    const int niter = 5;
+    std::atomic<int> ndone(0);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nthreads; i++) {
+	threads.push_back(std::thread([&ndone]() {
+	    for (int j = 0; j < niter; j++) {
+		PROFILE_SCOPE("test_profiler outer");
+		usleep(100);
+		{
+		    PROFILE_SCOPE("test_profiler inner");
+		    usleep(1000);
+		}
+	    }
+	    ndone++;
+	}));
+    }
+
+    // Concurrent reads while threads are running.
+    while (ndone.load() < nthreads)
+	get_profile();
+
+    for (auto &t: threads)
+	t.join();
+
+    profile_node profile = get_profile();
+    const profile_node *outer = profile.find("test_profiler outer");
+    assert(outer && (outer->count == nthreads * niter));
+
+    const profile_node *inner = outer->find("test_profiler inner");
+    assert(inner && (inner->count == nthreads * niter) && (inner->children.size() == 0));
+    assert(inner->total >= nthreads * niter * 1.0e-3 && inner->max >= 1.0e-3);
+    assert(outer->total > inner->total && fabs(outer->self - (outer->total - inner->total)) < 1.0e-9);
+
+    int nfound = 0;
+    for (const profile_node &p: get_thread_profiles()) {
+	const profile_node *o = p.find("test_profiler outer");
+	if (o && (o->count == niter))
+	    nfound++;
+    }
+    assert(nfound == nthreads);
+
+    stringstream ss;
+    print_profile(ss);
+    assert(ss.str().find("    test_profiler inner: 10 calls") != string::npos);
+
+    reset_profile();
+    profile = get_profile();
+    assert(profile.find("test_profiler outer")->count == 0);
+
+    cout << "test_profiler: pass" << endl;
+}
+
+
+class histogram_test_thread : public timing_thread {
+public:
+    histogram_test_thread(const shared_ptr<timing_thread_pool> &pool_, const shared_ptr<latency_histogram> &h) :
+	timing_thread(pool_, false, false)   // pin_to_core=false, warm_up_cpu=false
+    {
+	this->histogram = h;
+	this->verbose = false;
+    }
+
+    virtual void thread_body() override
+    {
+	this->name = "sleep";
+	this->run_trials(10, []() { usleep(200); });
+    }
+};
+
+
+static void test_latency_histogram()
+{
+    // Bin layout: contiguous, and every value falls in its bin.
+    for (int nbits: { 0, 3, 7 }) {
+	int nb = histogram_snapshot::num_bins(nbits);
+	assert(histogram_snapshot::bin_index(INT64_MAX, nbits) == nb-1);
+
+	for (int i = 1; i < nb; i++) {
+	    int64_t lo = histogram_snapshot::bin_lower_bound(i, nbits);
+	    assert(lo == histogram_snapshot::bin_lower_bound(i-1, nbits) + histogram_snapshot::bin_width(i-1, nbits));
+	    assert(histogram_snapshot::bin_index(lo, nbits) == i);
+	    assert(histogram_snapshot::bin_index(lo-1, nbits) == i-1);
+	}
+    }
+
+    histogram_snapshot h;
+    for (int64_t v = 1; v <= 100000; v++)
+	h.record(v);
+
+    assert((h.count == 100000) && (h.min == 1) && (h.max == 100000) && (fabs(h.mean() - 50000.5) < 1.0e-6));
+    assert(fabs(h.percentile(0.5) - 50000) <= 0.004 * 50000);
+    assert(fabs(h.percentile(0.999) - 99900) <= 0.004 * 99900);
+    assert((h.percentile(0.0) == 1) && (h.percentile(1.0) == 100000));
+
+    // Serialization round trip, and merging.
+    stringstream ss;
+    h.serialize(ss);
+    histogram_snapshot h2 = histogram_snapshot::deserialize(ss);
+    assert((h2.bins == h.bins) && (h2.count == h.count) && (h2.max == h.max) && (h2.sum == h.sum));
+
+    h2.merge(h);
+    assert((h2.count == 200000) && (h2.percentile(0.5) == h.percentile(0.5)));
+
+    bool thrown = false;
+    try {
+	stringstream bad("histogram_snapshot 7 10 1 2 3.0 1\n5 9\n");
+	histogram_snapshot::deserialize(bad);
+    } catch (std::runtime_error &) {
+	thrown = true;
+    }
+    assert(thrown);
+
+    // Concurrent recording, with and without explicit shards.
+    const int nthreads = 4;
+    latency_histogram lh(nthreads);
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < nthreads; i++) {
+	threads.push_back(std::thread([&lh,i]() {
+	    for (int j = 0; j < 10000; j++) {
+		lh.record(j, i);
+		lh.record(-5);
+	    }
+	}));
+    }
+    for (auto &t: threads)
+	t.join();
+
+    histogram_snapshot s = lh.snapshot();
+    assert((s.count == 2 * nthreads * 10000) && (s.min == 0) && (s.max == 9999));
+    assert(s.bins[0] == nthreads * 10001);
+
+    lh.reset();
+    assert(lh.snapshot().count == 0);
+
+    // Recording from timing_thread::stop_timer().
+    auto pool = make_shared<timing_thread_pool> (2);
+    auto th = make_shared<latency_histogram> (2);
+    std::vector<std::thread> tt;
+    for (int i = 0; i < 2; i++)
+	tt.push_back(spawn_timing_thread<histogram_test_thread> (pool, th));
+    for (auto &t: tt)
+	t.join();
+
+    s = th->snapshot();
+    assert((s.count == 20) && (s.min >= 200000));
+
+    cout << "test_latency_histogram: pass" << endl;
+}
+
+
+class perf_test_thread : public timing_thread {
+public:
+    shared_ptr<std::vector<std::array<double,PERF_NCOUNTERS>>> totals;   // perf_totals, per thread
+
+    perf_test_thread(const shared_ptr<timing_thread_pool> &pool_, const shared_ptr<std::vector<std::array<double,PERF_NCOUNTERS>>> &totals_) :
+	timing_thread(pool_, false, false),   // pin_to_core=false, warm_up_cpu=false
+	totals(totals_)
+    {
+	this->use_perf_counters = true;
+	this->verbose = false;
+    }
+
+    virtual void thread_body() override
+    {
+	volatile double x = 0.0;
+
+	this->name = "loop";
+	this->run_trials(3, [&x]() { for (int i = 0; i < 100000; i++) x = x + 1.0; });
+
+	for (int i = 0; i < PERF_NCOUNTERS; i++)
+	    totals->at(thread_id)[i] = perf_totals[i];
+
+	// Counters which are unavailable (e.g. in a VM) read as zero.
+	for (int i = 0; i < PERF_NCOUNTERS; i++)
+	    if (!perf->available(i))
+		assert(perf_totals[i] == 0.0);
+    }
+};
+
+
+// Checks that perf_counters degrades gracefully: without counters, available() is false, there is
+// an error message, start()/stop()/reset() are no-ops, and read() returns zeros.
+static bool perf_counters_degrade_gracefully(const perf_counters &p)
+{
+    double v[PERF_NCOUNTERS];
+    p.read(v);
+
+    bool ok = !p.available() && (p.error_message().size() > 0);
+    for (int i = 0; i < PERF_NCOUNTERS; i++)
+	ok = ok && !p.available(i) && (v[i] == 0.0);
+
+    return ok;
+}
+
+
+// Runs perf_counters in a child process where perf_event_open() is denied (EACCES, via a seccomp
+// filter), so that the "denied" path is tested even on machines where counters are available.
+static void test_perf_counters_denied()
+{
+#if defined(__linux__) && defined(__NR_perf_event_open)
+    pid_t pid = fork();
+    assert(pid >= 0);
+
+    if (pid == 0) {
+	struct sock_filter filter[] = {
+	    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+	    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_perf_event_open, 0, 1),
+	    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | EACCES),
+	    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW)
+	};
+
+	struct sock_fprog prog;
+	prog.len = sizeof(filter) / sizeof(filter[0]);
+	prog.filter = filter;
+
+	// Exit status 2 means seccomp is unavailable (test skipped).
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) || prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog))
+	    _exit(2);
+
+	perf_counters p;
+	p.start();
+	p.stop();
+	p.reset();
+
+	bool ok = perf_counters_degrade_gracefully(p) && (p.error_message().find("perf_event_paranoid") != string::npos);
+	_exit(ok ? 0 : 1);
+    }
+
+    int status = 0;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && (WEXITSTATUS(status) != 1));
+#endif
+}
+
+
+static void test_perf_counters()
+{
+    // Whether or not counters are available on this machine, the class must be usable.
+    perf_counters p;
+    p.start();
+    p.stop();
+    assert(p.available() || perf_counters_degrade_gracefully(p));
+
+    test_perf_counters_denied();
+
+    // Summed over threads in stop_timer(): every thread sees the same totals.
+    auto pool = make_shared<timing_thread_pool> (3);
+    auto totals = make_shared<std::vector<std::array<double,PERF_NCOUNTERS>>> (3);
+
+    std::vector<std::thread> tt;
+    for (int i = 0; i < 3; i++)
+	tt.push_back(spawn_timing_thread<perf_test_thread> (pool, totals));
+    for (auto &t: tt)
+	t.join();
+
+    const auto &v = *totals;
+    assert((v[1] == v[0]) && (v[2] == v[0]));
+
+    cout << "test_perf_counters: pass" << endl;
+}
+
+
+static void test_interference_monitor()
+{
+    interference_snapshot a = take_interference_snapshot();
+    usleep(1000);
+    interference_snapshot b = take_interference_snapshot();
+    assert(b.time_ns > a.time_ns);
+    assert(b.voluntary_csw >= a.voluntary_csw);
+
+    // Interrupt counts are per-cpu, so they're only comparable if the (unpinned) thread didn't migrate.
+    if (a.cpu == b.cpu)
+	assert(b.interrupts >= a.interrupts);
+
+    // Synthetic snapshots: 1 second apart, on the same cpu.
+    a = interference_snapshot();
+    a.cpu = 3;
+    a.freq_ghz = 3.0;
+    b = a;
+    b.time_ns = a.time_ns + 1000000000;
+    b.interrupts = 1000;
+    b.voluntary_csw = 10;
+    assert(!compare_interference_snapshots(a, b).flagged);
+
+    interference_snapshot c = b;
+    c.freq_ghz = 2.0;
+    assert(compare_interference_snapshots(a, c).flagged);
+
+    c = b;
+    c.interrupts = 5000;
+    interference_report r = compare_interference_snapshots(a, c);
+    assert(r.flagged && (r.interrupts == 5000));
+    assert(r.describe().find("5000 interrupts") != std::string::npos);
+
+    // A single interrupt in a short (100 usec) region is not flagged, but two are.
+    c = b;
+    c.time_ns = a.time_ns + 100000;
+    c.interrupts = 1;
+    assert(!compare_interference_snapshots(a, c).flagged);
+    c.interrupts = 2;
+    assert(compare_interference_snapshots(a, c).flagged);
+
+    c = b;
+    c.involuntary_csw = 1;
+    assert(compare_interference_snapshots(a, c).flagged);
+
+    interference_thresholds t;
+    t.max_involuntary_csw = -1;    // disabled
+    assert(!compare_interference_snapshots(a, c, t).flagged);
+
+    c = b;
+    c.cpu = 4;
+    assert(compare_interference_snapshots(a, c).migrated);
+
+    cout << "test_interference_monitor: pass" << endl;
+}
+
+
+class scaling_test_thread : public timing_thread {
+public:
+    scaling_test_thread(const shared_ptr<timing_thread_pool> &pool_) :
+	timing_thread(pool_, false, false)   // pin_to_core=false, warm_up_cpu=false
+    { }
+
+    virtual void thread_body() override
+    {
+	this->name = "sleep";
+	this->nbytes_accessed = 1000;
+	this->run_trials(3, []() { usleep(1000); });
+    }
+};
+
+
+static void test_scaling_sweep()
+{
+    // Synthetic weak-scaling series: efficiency 1, 1, 2/3, 1/3.
+    std::vector<scaling_point> v(4);
+    for (int i = 0; i < 4; i++) {
+	v[i].name = "x";
+	v[i].nthreads = 1 << i;
+	v[i].global_dt = std::vector<double> ({ 1.0, 1.0, 1.5, 3.0 }) [i];
+    }
+
+    analyze_scaling(v, true, 0.15);
+    assert(std::fabs(v[2].speedup - 8.0/3.0) < 1.0e-10);
+    assert(std::fabs(v[3].efficiency - 1.0/3.0) < 1.0e-10);
+    assert(!v[0].knee && !v[1].knee && v[2].knee && v[3].knee);
+
+    // Strong scaling, same global_dt values (1, 1, 1.5, 3 at 1, 2, 4, 8 threads).  The total work is now
+    // fixed, so speedup = dt(1)/dt(n) = 1, 1, 2/3, 1/3, and efficiency = speedup/n = 1, 1/2, 1/6, 1/24.
+    analyze_scaling(v, false, 0.15);
+    assert(std::fabs(v[2].speedup - 2.0/3.0) < 1.0e-10);
+    assert(std::fabs(v[3].efficiency - 1.0/24.0) < 1.0e-10);
+
+    scaling_sweep_params params;
+    params.thread_counts = { 1, 2 };
+    v = run_scaling_sweep<scaling_test_thread> (params);
+
+    assert(v.size() == 2);
+    assert((v[0].nthreads == 1) && (v[1].nthreads == 2));
+    assert((v[0].name == "sleep") && (v[1].nbytes_per_thread == 1000));
+    assert(v[0].global_dt > 0.0009 && v[0].speedup == 1.0);
+
+    cout << "test_scaling_sweep: pass" << endl;
+}
+
+
+class registry_test_benchmark : public benchmark_thread {
+public:
+    registry_test_benchmark(const shared_ptr<timing_thread_pool> &pool_, const benchmark_params &params_) :
+	benchmark_thread(pool_, params_)
+    { }
+
+    virtual void thread_body() override
+    {
+	this->name = "a";
+	this->run_trials([]() { });
+	this->name = "b";
+	this->nbytes_accessed = 100;
+	this->run_trials([]() { });
+    }
+};
+
+static benchmark_registrar<registry_test_benchmark> reg_test("test/registry", "used by run-tests");
+
+
+static void test_benchmark_registry()
+{
+    assert(match_benchmarks("test/*").size() == 1);
+    assert(match_benchmarks("nonexistent,test/reg*").size() == 1);
+    assert(match_benchmarks("test").size() == 0);
+
+    benchmark_params params;
+    params.nthreads = 2;
+    params.ntrials = 3;
+    params.pin_to_core = false;
+    params.warm_up_cpu = false;
+
+    std::vector<benchmark_result> v = run_benchmark(match_benchmarks("test/registry")[0], params);
+    assert(v.size() == 2);
+    assert((v[0].name == "a") && (v[1].name == "b") && (v[1].benchmark == "test/registry"));
+    assert((v[1].samples.size() == 3) && (v[1].stats.ntrials == 3) && (v[1].nbytes_accessed == 100));
+
+    std::stringstream ss;
+    write_results_json(ss, v);
+    assert(ss.str().find("\"name\": \"b\"") != std::string::npos);
+    assert(ss.str().find("\"hostname\"") != std::string::npos);
+
+    cout << "test_benchmark_registry: pass" << endl;
+}
+
+
+static void test_benchmark_compare()
+{
+    std::vector<double> x = { 1.0, 1.1, 1.2, 1.3, 1.4, 1.5, 1.6, 1.7 };
+    std::vector<double> y = { 2.0, 2.1, 2.2, 2.3, 2.4, 2.5, 2.6, 2.7 };
+
+    assert(mann_whitney_p_value(y, x) < 0.01);
+    assert(mann_whitney_p_value(x, y) > 0.99);
+    assert(std::fabs(mann_whitney_p_value(x, x) - 0.5) < 0.1);
+    assert(mann_whitney_p_value(x, { 1.0, 2.0 }) == 1.0);
+
+    benchmark_result b;
+    b.benchmark = "test/compare";
+    b.name = "x";
+    b.params.nthreads = 2;
+    b.params.pin_to_core = false;
+    b.samples = x;
+
+    // Round trip through JSON.
+    std::stringstream ss;
+    write_results_json(ss, { b });
+    std::vector<benchmark_result> v = read_results_json(ss);
+    assert((v.size() == 1) && (v[0].samples == x) && (v[0].params.nthreads == 2) && !v[0].params.pin_to_core);
+
+    benchmark_result c = b;
+    c.samples = y;
+
+    std::vector<benchmark_comparison> r = compare_results(v, { c });
+    assert((r.size() == 1) && r[0].regression && !r[0].improvement);
+
+    r = compare_results({ c }, v);
+    assert((r.size() == 1) && !r[0].regression && r[0].improvement);
+
+    // Within threshold: not a regression, even though statistically significant.  Every sample is
+    // slower than every baseline sample (so p_slower is small), but the medians differ by only 1%.
+    benchmark_result b2 = b;
+    benchmark_result c2 = b;
+    for (int i = 0; i < 8; i++) {
+	b2.samples[i] = 1.0 + 0.001 * i;
+	c2.samples[i] = 1.01 + 0.001 * i;
+    }
+
+    r = compare_results({ b2 }, { c2 }, 0.05, 0.01);
+    assert((r.size() == 1) && (r[0].p_slower < 0.01) && (r[0].ratio < 1.05));
+    assert(!r[0].regression && !r[0].improvement);
+
+    // ... but it is a regression with threshold=0.
+    r = compare_results({ b2 }, { c2 }, 0.0, 0.01);
+    assert((r.size() == 1) && r[0].regression);
+
+    // No counterpart in baseline.
+    c.params.nthreads = 3;
+    assert(compare_results(v, { c }).size() == 0);
+
+    cout << "test_benchmark_compare: pass" << endl;
+}
+
+
 int main(int argc, char **argv)
 {
+    test_task_pool_destroyed_from_worker();   // forks, so must run before any threads are created
     test_round_up_to_power_of_two();
+    test_aligned_allocator();
+    test_parallel_first_touch();
+    test_buffer_pool();
+    test_memory_arena();
+    test_memory_accounting();
+    test_strided_array();
+    test_philox();
+    test_timing_statistics();
+    test_barriers();
+    test_tree_allreduce();
+    test_pinning();
+    test_warm_up_cpu();
+    test_trace();
+    test_profiler();
+    test_latency_histogram();
+    test_perf_counters();
+    test_interference_monitor();
+    test_scaling_sweep();
+    test_benchmark_registry();
+    test_benchmark_compare();
+    test_task_pool();
+    test_parallel_for();
     test_lexical_cast();
     return 0;
 }
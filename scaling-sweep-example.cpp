@@ -0,0 +1,61 @@
+#include <vector>
+#include <iostream>
+#include "memory_utils.hpp"
+#include "scaling_sweep.hpp"
+
+using namespace std;
+
+
+// Two kernels with different scaling behavior: a memory-bound triad (which should show a knee
+// once the memory bus saturates), and a compute-bound loop (which should scale up to the number
+// of physical cores).
+class my_timing_thread : public timing_thread {
+public:
+    const ssize_t nelts;
+
+    my_timing_thread(const shared_ptr<timing_thread_pool> &pool_, ssize_t nelts_) :
+	timing_thread(pool_, true, false),   // pin_to_core=true, warm_up_cpu=false
+	nelts(nelts_)
+    { }
+
+    virtual ~my_timing_thread() { }
+
+    virtual void thread_body() override
+    {
+	uptr<float> a = make_uptr<float> (nelts);
+	uptr<float> b = make_uptr<float> (nelts);
+	uptr<float> c = make_uptr<float> (nelts);
+
+	this->name = "triad";
+	this->nbytes_accessed = 3 * nelts * sizeof(float);
+	this->run_trials(5, [&]() {
+	    for (ssize_t i = 0; i < nelts; i++)
+		a[i] = b[i] + 1.5f * c[i];
+	});
+
+	float x = 1.0f;
+
+	this->name = "compute";
+	this->nbytes_accessed = 0;
+	this->run_trials(5, [&]() {
+	    for (int i = 0; i < 10000000; i++)
+		x = x * x * 0.25f + 0.5f;
+	});
+
+	// Prevents the compute loop from being optimized out.
+	volatile float sink = x;
+	(void) sink;
+    }
+};
+
+
+int main(int argc, char **argv)
+{
+    scaling_sweep_params params;
+    params.pinnings = { PIN_COMPACT, PIN_SCATTER };
+
+    vector<scaling_point> v = run_scaling_sweep<my_timing_thread> (params, ssize_t(1) << 24);
+    print_scaling_report(v);
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+
+#include "scaling_sweep.hpp"
+
+using namespace std;
+
+
+vector<int> default_thread_counts()
+{
+    int ncpus = max(int(get_cpu_topology().cpus.size()), 1);
+    vector<int> ret;
+
+    for (int n = 1; n < ncpus; n *= 2)
+	ret.push_back(n);
+
+    ret.push_back(ncpus);
+    return ret;
+}
+
+
+void append_scaling_points(vector<scaling_point> &points, const timing_thread_pool &pool, pinning_policy pinning)
+{
+    for (const string &name: pool.get_sample_names()) {
+	scaling_point p;
+	p.name = name;
+	p.pinning = pinning;
+	p.nthreads = pool.nthreads;
+	p.global_dt = compute_timing_statistics(pool.get_samples(name)).median;
+	p.nbytes_per_thread = pool.get_nbytes_accessed(name);
+
+	if ((p.nbytes_per_thread > 0) && (p.global_dt > 0.0))
+	    p.gbps_per_thread = p.nbytes_per_thread / p.global_dt / pow(2.,30.);
+
+	points.push_back(p);
+    }
+}
+
+
+// Orders points into (name, pinning) series, sorted by nthreads.
+static bool series_order(const scaling_point *a, const scaling_point *b)
+{
+    if (a->name != b->name)
+	return a->name < b->name;
+    if (a->pinning != b->pinning)
+	return a->pinning < b->pinning;
+    return a->nthreads < b->nthreads;
+}
+
+
+void analyze_scaling(vector<scaling_point> &points, bool weak_scaling, double knee_threshold)
+{
+    vector<scaling_point *> v;
+    for (scaling_point &p: points)
+	v.push_back(&p);
+
+    std::stable_sort(v.begin(), v.end(), series_order);
+
+    // Baseline: first point in series.
+    scaling_point *base = nullptr;
+
+    for (size_t i = 0; i < v.size(); i++) {
+	scaling_point *p = v[i];
+	bool first = (i == 0) || (v[i-1]->name != p->name) || (v[i-1]->pinning != p->pinning);
+
+	if (first)
+	    base = p;
+
+	double n = weak_scaling ? p->nthreads : base->nthreads;
+	p->speedup = (p->global_dt > 0.0) ? (n * base->global_dt / p->global_dt) : 0.0;
+	p->efficiency = p->speedup / p->nthreads;
+	p->knee = !first && (p->efficiency < (1.0 - knee_threshold) * v[i-1]->efficiency);
+    }
+}
+
+
+void print_scaling_report(const vector<scaling_point> &points, ostream &os)
+{
+    vector<const scaling_point *> v;
+    for (const scaling_point &p: points)
+	v.push_back(&p);
+
+    std::stable_sort(v.begin(), v.end(), series_order);
+
+    os << left << setw(24) << "name" << setw(16) << "pinning" << right << setw(9) << "nthreads"
+       << setw(14) << "global_dt" << setw(10) << "speedup" << setw(12) << "efficiency"
+       << setw(16) << "GB/s/thread" << endl;
+
+    for (size_t i = 0; i < v.size(); i++) {
+	const scaling_point &p = *v[i];
+
+	// Blank line between series.
+	if ((i > 0) && ((v[i-1]->name != p.name) || (v[i-1]->pinning != p.pinning)))
+	    os << endl;
+
+	os << left << setw(24) << p.name << setw(16) << pinning_policy_name(p.pinning) << right
+	   << setw(9) << p.nthreads << setw(14) << p.global_dt << setw(10) << setprecision(3) << p.speedup
+	   << setw(12) << p.efficiency << setw(16) << p.gbps_per_thread << setprecision(6);
+
+	if (p.knee)
+	    os << "   <-- knee";
+
+	os << endl;
+    }
+}
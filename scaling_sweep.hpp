@@ -0,0 +1,102 @@
+#ifndef _SCALING_SWEEP_HPP
+#define _SCALING_SWEEP_HPP
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <memory>
+#include <iostream>
+
+#include "timing_thread.hpp"
+
+
+// Thread-scaling sweep: reruns a timing_thread subclass over a range of thread counts and pinning
+// policies, and tabulates global_dt, speedup, parallel efficiency and per-thread bandwidth for every
+// benchmark name the subclass times.  Example:
+//
+//   scaling_sweep_params params;
+//   params.pinnings = { PIN_COMPACT, PIN_SCATTER };
+//
+//   // Extra arguments are passed to the subclass constructor, after the pool.
+//   vector<scaling_point> v = run_scaling_sweep<my_timing_thread> (params, nelts);
+//   print_scaling_report(v);
+//
+// Each timing_thread's 'nbytes_accessed' is interpreted as the number of bytes accessed by each
+// thread.  If a name is timed more than once (e.g. with run_trials()), the median is used.
+
+
+struct scaling_sweep_params {
+    std::vector<int> thread_counts;    // if empty, 1, 2, 4, ... up to the number of allowed cpus
+    std::vector<pinning_policy> pinnings = { PIN_SEQUENTIAL };
+    timer_type timer = TIMER_MONOTONIC;
+    barrier_type barrier = BARRIER_MUTEX;
+
+    // Weak scaling: each thread does a fixed amount of work, so ideal global_dt is independent of nthreads.
+    // Strong scaling: total work is fixed (the subclass divides it by timing_thread::nthreads).
+    bool weak_scaling = true;
+
+    // A point is flagged as a knee if its efficiency is less than (1 - knee_threshold) times the
+    // efficiency at the previous thread count.
+    double knee_threshold = 0.15;
+
+    // Passed to timing_thread_pool::verbose (by default, the subclass's own output is suppressed).
+    bool verbose = false;
+};
+
+
+struct scaling_point {
+    std::string name;
+    pinning_policy pinning = PIN_SEQUENTIAL;
+    int nthreads = 0;
+
+    double global_dt = 0.0;         // seconds (median over samples)
+    ssize_t nbytes_per_thread = 0;  // from timing_thread::nbytes_accessed
+    double speedup = 0.0;           // relative to the smallest thread count (assumed to scale perfectly)
+    double efficiency = 0.0;        // speedup / nthreads
+    double gbps_per_thread = 0.0;   // GB/sec, with GB = 2^30 bytes, as in timing_thread::stop_timer()
+    bool knee = false;
+};
+
+
+// Default thread counts: 1, 2, 4, ..., plus the number of allowed cpus if not a power of two.
+extern std::vector<int> default_thread_counts();
+
+// Appends one scaling_point per benchmark name in the pool (speedup/efficiency/knee are not filled in).
+extern void append_scaling_points(std::vector<scaling_point> &points, const timing_thread_pool &pool, pinning_policy pinning);
+
+// Fills in speedup, efficiency and knee, for each (name, pinning) series.
+extern void analyze_scaling(std::vector<scaling_point> &points, bool weak_scaling, double knee_threshold);
+
+extern void print_scaling_report(const std::vector<scaling_point> &points, std::ostream &os=std::cout);
+
+
+template<typename T, typename... Args>
+std::vector<scaling_point> run_scaling_sweep(const scaling_sweep_params &params, Args... args)
+{
+    std::vector<int> thread_counts = params.thread_counts;
+    std::vector<scaling_point> ret;
+
+    if (thread_counts.size() == 0)
+	thread_counts = default_thread_counts();
+
+    for (pinning_policy pinning: params.pinnings) {
+	for (int nthreads: thread_counts) {
+	    auto pool = std::make_shared<timing_thread_pool> (nthreads, params.timer, params.barrier, pinning);
+	    pool->verbose = params.verbose;
+
+	    std::vector<std::thread> threads(nthreads);
+	    for (int i = 0; i < nthreads; i++)
+		threads[i] = spawn_timing_thread<T> (pool, args...);
+	    for (int i = 0; i < nthreads; i++)
+		threads[i].join();
+
+	    append_scaling_points(ret, *pool, pinning);
+	}
+    }
+
+    analyze_scaling(ret, params.weak_scaling, params.knee_threshold);
+    return ret;
+}
+
+
+#endif  // _SCALING_SWEEP_HPP
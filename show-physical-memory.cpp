@@ -1,32 +1,9 @@
-#include <errno.h>
-#include <unistd.h>
-
 #include <cmath>
-#include <string>
-#include <cstring>
 #include <iostream>
-#include <stdexcept>
-
-using namespace std;
-
-
-static ssize_t get_physical_memory()
-{
-    ssize_t pagesize = sysconf(_SC_PAGESIZE);
-    if (pagesize < 0)
-	throw runtime_error(string("sysconf(_SC_PAGESIZE) failed: ") + strerror(errno));
-
-    ssize_t npages = sysconf(_SC_PHYS_PAGES);
-    if (npages < 0)
-	throw runtime_error(string("sysconf(_SC_PHYS_PAGES) failed: ") + strerror(errno));
-
-    ssize_t nbytes = npages * pagesize;
 
-    if (nbytes <= 0)
-	throw runtime_error("get_physical_memory(): zero bytes found?!");
+#include "memory_utils.hpp"
 
-    return nbytes;
-}
+using namespace std;
 
 
 int main(int argc, char **argv)
@@ -0,0 +1,190 @@
+// STREAM-style memory bandwidth benchmark (copy, scale, add, triad, read-only, write-only),
+// swept over thread counts, pinning policies, and per-thread working set sizes (L1 through DRAM).
+//
+// Each thread allocates and first-touches its own arrays after pinning, so on a NUMA machine the
+// arrays are local to the thread.  Bytes are counted as in STREAM (no write-allocate traffic), and
+// bandwidths are reported in decimal GB/sec.  Output is CSV on stdout (one row per kernel/config).
+//
+// Usage: stream-benchmark [-t max_threads] [-p pinning[,pinning...]] [-s min_kib] [-m max_mib] [-n ntrials] [-u]
+//
+//   -t  thread counts are 1, 2, 4, ... up to max_threads (default: number of allowed cpus)
+//   -p  comma-separated pinning policies (sequential, compact, scatter, physical_cores; default sequential)
+//   -s  smallest per-thread working set, in KiB (default 16)
+//   -m  largest per-thread working set, in MiB (default 256)
+//   -n  trials per kernel (default 10)
+//   -u  don't pin threads
+
+#include <cmath>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+#include "argument_parser.hpp"
+#include "memory_utils.hpp"
+#include "memory_kernels.hpp"
+#include "timing_thread.hpp"
+
+using namespace std;
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// stream_thread
+
+
+class stream_thread : public timing_thread {
+public:
+    const ssize_t nelts;
+    const int nreps;      // kernel passes per trial
+    const int ntrials;
+
+    // Prevents the read kernel from being optimized out (one per thread, so that threads don't race).
+    volatile double sink = 0.0;
+
+    stream_thread(const shared_ptr<timing_thread_pool> &pool_, bool pin_to_core, bool warm_up, ssize_t nelts_, int nreps_, int ntrials_) :
+	timing_thread(pool_, pin_to_core, warm_up), nelts(nelts_), nreps(nreps_), ntrials(ntrials_)
+    {
+	// Timings are read back from the pool and printed as CSV by main().
+	this->verbose = false;
+    }
+
+    virtual ~stream_thread() { }
+
+    virtual void thread_body() override
+    {
+	// First touch happens here, on the (pinned) thread which uses the arrays.
+	uptr<double> a = make_uptr<double> (nelts);
+	uptr<double> b = make_uptr<double> (nelts);
+	uptr<double> c = make_uptr<double> (nelts);
+
+	for (ssize_t i = 0; i < nelts; i++) {
+	    a[i] = 1.0;
+	    b[i] = 2.0;
+	}
+
+	const double s = 3.0;
+	double sum = 0.0;
+
+	for (int k = 0; k < STREAM_NKERNELS; k++) {
+	    this->name = stream_kernel_names[k];
+
+	    this->run_trials(ntrials, [&]() {
+		for (int r = 0; r < nreps; r++)
+		    sum += run_stream_kernel(k, a.get(), b.get(), c.get(), s, nelts);
+	    });
+	}
+
+	sink = sum;
+    }
+};
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// main()
+
+
+static vector<string> split_commas(const string &s)
+{
+    vector<string> ret;
+    size_t pos = 0;
+
+    for (;;) {
+	size_t end = s.find(',', pos);
+	ret.push_back(s.substr(pos, end - pos));
+	if (end == string::npos)
+	    return ret;
+	pos = end + 1;
+    }
+}
+
+
+static void usage()
+{
+    cerr << "usage: stream-benchmark [-t max_threads] [-p pinning[,pinning...]] [-s min_kib] [-m max_mib] [-n ntrials] [-u]" << endl;
+    exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+    const cpu_topology &topo = get_cpu_topology();
+
+    int max_threads = topo.cpus.size();
+    string pinning_list = "sequential";
+    long min_kib = 16;
+    long max_mib = 256;
+    int ntrials = 10;
+    bool unpinned = false;
+
+    argument_parser parser;
+    parser.add_flag_with_parameter("-t", max_threads);
+    parser.add_flag_with_parameter("-p", pinning_list);
+    parser.add_flag_with_parameter("-s", min_kib);
+    parser.add_flag_with_parameter("-m", max_mib);
+    parser.add_flag_with_parameter("-n", ntrials);
+    parser.add_boolean_flag("-u", unpinned);
+
+    if (!parser.parse_args(argc, argv) || (parser.nargs > 0))
+	usage();
+    if ((max_threads < 1) || (min_kib < 1) || (max_mib < 1) || (ntrials < 1))
+	usage();
+
+    vector<pinning_policy> pinnings;
+    for (const string &s: split_commas(pinning_list))
+	pinnings.push_back(pinning_policy_from_string(s));
+
+    vector<int> thread_counts;
+    for (int n = 1; n < max_threads; n *= 2)
+	thread_counts.push_back(n);
+    thread_counts.push_back(max_threads);
+
+    // Per-thread working sets (all three arrays), in powers of two.
+    vector<ssize_t> working_sets;
+    for (ssize_t ws = min_kib << 10; ws <= (max_mib << 20); ws *= 2)
+	working_sets.push_back(ws);
+
+    // Metadata goes to stderr, so that stdout is pure CSV.
+    topo.print(cerr);
+
+    cout << "kernel,pinning,nthreads,nbytes_per_thread,nbytes_total,level,ntrials,nreps,"
+	 << "min_seconds,median_seconds,max_gbps,median_gbps" << endl;
+
+    for (pinning_policy pinning: pinnings) {
+	for (int nthreads: thread_counts) {
+	    for (size_t iws = 0; iws < working_sets.size(); iws++) {
+		ssize_t nelts = working_sets[iws] / (3 * sizeof(double));
+
+		// Enough passes per trial that each trial moves at least ~64 MB per thread.
+		int nreps = max(ssize_t(1), ssize_t(64 << 20) / working_sets[iws]);
+
+		// Warm-up is only needed once per thread configuration.
+		bool warm_up = (iws == 0);
+
+		auto pool = make_shared<timing_thread_pool> (nthreads, TIMER_MONOTONIC, BARRIER_HYBRID, pinning);
+
+		vector<thread> threads(nthreads);
+		for (int i = 0; i < nthreads; i++)
+		    threads[i] = spawn_timing_thread<stream_thread> (pool, !unpinned, warm_up, nelts, nreps, ntrials);
+		for (int i = 0; i < nthreads; i++)
+		    threads[i].join();
+
+		for (int k = 0; k < STREAM_NKERNELS; k++) {
+		    timing_statistics s = compute_timing_statistics(pool->get_samples(stream_kernel_names[k]));
+
+		    ssize_t nbytes_per_thread = stream_kernel_narrays[k] * nelts * sizeof(double);
+		    ssize_t nbytes_total = nbytes_per_thread * nthreads;
+		    double nbytes_trial = double(nbytes_total) * nreps;
+
+		    cout << stream_kernel_names[k] << "," << pinning_policy_name(pinning) << "," << nthreads
+			 << "," << nbytes_per_thread << "," << nbytes_total << "," << topo.memory_level(nbytes_per_thread, nbytes_total)
+			 << "," << s.ntrials << "," << nreps << "," << s.min << "," << s.median
+			 << "," << (nbytes_trial / s.min / 1.0e9) << "," << (nbytes_trial / s.median / 1.0e9) << endl;
+		}
+	    }
+	}
+    }
+
+    return 0;
+}
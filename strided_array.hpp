@@ -0,0 +1,196 @@
+#ifndef _STRIDED_ARRAY_HPP
+#define _STRIDED_ARRAY_HPP
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "memory_utils.hpp"
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// strided_array<T,N>: an N-dimensional array which owns its memory (allocated with make_uptr()),
+// with the innermost dimension padded so that rows start on cache-line (or SIMD-width) boundaries.
+//
+//   strided_array<float,3> a(nx, ny, nz);      // zeroed, rows padded to 64 bytes
+//   a(i,j,k) = 1.0;
+//
+//   strided_array_view<float,2> b = a[i];      // sub-array views share memory with 'a'
+//   strided_array_view<float,1> c = a[i][j];
+//   float *row = &a(i,j,0);                    // 64-byte aligned
+//
+//   strided_array_view<float,3> d = a.range(1, 10, 20);   // 10 <= j < 20, no copy
+//
+// Padding is controlled by a strided_array_padding argument to the constructor:
+//
+//   strided_array<float,2> e({ nx, ny }, strided_array_padding(32, 0));
+//
+//   align_nbytes: every stride (except the innermost) is a multiple of this many bytes, so that rows
+//     never straddle cache lines.  Use e.g. 32/64 for AVX2/AVX-512 vectors.
+//
+//   antialias_nbytes: if a stride is a multiple of this many bytes, it is increased by align_nbytes.
+//     This avoids the case where consecutive rows map to the same cache set (e.g. 4 KB rows on a cache
+//     with 4 KB per way), which causes conflict misses in row-parallel kernels.  Set to zero to disable.
+
+
+struct strided_array_padding {
+    ssize_t align_nbytes = 64;
+    ssize_t antialias_nbytes = 4096;
+
+    strided_array_padding() { }
+    strided_array_padding(ssize_t align_nbytes_, ssize_t antialias_nbytes_=4096) :
+	align_nbytes(align_nbytes_), antialias_nbytes(antialias_nbytes_)
+    { }
+};
+
+
+template<typename T, int N> struct strided_array_view;
+
+// Helper for strided_array_view<T,N>::operator[]: returns a view for N > 1, and a reference for N == 1.
+template<typename T, int N>
+struct _strided_array_subscript {
+    typedef strided_array_view<T,N-1> type;
+    static inline type get(const strided_array_view<T,N> &v, ssize_t i);
+};
+
+template<typename T>
+struct _strided_array_subscript<T,1> {
+    typedef T &type;
+    static inline type get(const strided_array_view<T,1> &v, ssize_t i) { return v.data[i * v.strides[0]]; }
+};
+
+
+// Non-owning view.  Strides are in units of elements (not bytes).
+template<typename T, int N>
+struct strided_array_view {
+    static_assert(N >= 1, "strided_array_view: N must be >= 1");
+
+    T *data = nullptr;
+    ssize_t shape[N];
+    ssize_t strides[N];
+
+    strided_array_view()
+    {
+	for (int k = 0; k < N; k++)
+	    shape[k] = strides[k] = 0;
+    }
+
+    template<typename... Args>
+    inline T &operator()(Args... ix) const
+    {
+	static_assert(sizeof...(Args) == N, "strided_array_view: wrong number of indices");
+
+	ssize_t i[N] = { ssize_t(ix)... };
+	ssize_t offset = 0;
+
+	for (int k = 0; k < N; k++)
+	    offset += i[k] * strides[k];
+
+	return data[offset];
+    }
+
+    inline typename _strided_array_subscript<T,N>::type operator[](ssize_t i) const
+    {
+	return _strided_array_subscript<T,N>::get(*this, i);
+    }
+
+    // Returns a view of the subarray lo <= index < hi along 'axis'.
+    inline strided_array_view<T,N> range(int axis, ssize_t lo, ssize_t hi) const
+    {
+	if ((axis < 0) || (axis >= N))
+	    throw std::runtime_error("strided_array_view::range(): axis=" + std::to_string(axis) + " out of range");
+	if ((lo < 0) || (lo > hi) || (hi > shape[axis]))
+	    throw std::runtime_error("strided_array_view::range(): invalid range [" + std::to_string(lo) + "," + std::to_string(hi) + ")");
+
+	strided_array_view<T,N> ret = *this;
+	ret.data = data + lo * strides[axis];
+	ret.shape[axis] = hi - lo;
+	return ret;
+    }
+
+    inline ssize_t size() const
+    {
+	ssize_t ret = 1;
+	for (int k = 0; k < N; k++)
+	    ret *= shape[k];
+	return ret;
+    }
+};
+
+
+template<typename T, int N>
+inline strided_array_view<T,N-1> _strided_array_subscript<T,N>::get(const strided_array_view<T,N> &v, ssize_t i)
+{
+    strided_array_view<T,N-1> ret;
+    ret.data = v.data + i * v.strides[0];
+
+    for (int k = 0; k < N-1; k++) {
+	ret.shape[k] = v.shape[k+1];
+	ret.strides[k] = v.strides[k+1];
+    }
+
+    return ret;
+}
+
+
+// Owning array.  Noncopyable (but movable), like uptr<T>.
+template<typename T, int N>
+struct strided_array : public strided_array_view<T,N> {
+    uptr<T> ref;
+    ssize_t nalloc = 0;    // number of elements allocated, including padding
+
+    strided_array() { }
+
+    template<typename... Args>
+    strided_array(Args... shape_)
+    {
+	static_assert(sizeof...(Args) == N, "strided_array: wrong number of dimensions");
+	ssize_t s[N] = { ssize_t(shape_)... };
+	_allocate(s, strided_array_padding());
+    }
+
+    strided_array(const std::vector<ssize_t> &shape_, const strided_array_padding &padding)
+    {
+	if (shape_.size() != N)
+	    throw std::runtime_error("strided_array: wrong number of dimensions");
+	_allocate(&shape_[0], padding);
+    }
+
+    strided_array(strided_array &&) = default;
+    strided_array &operator=(strided_array &&) = default;
+
+    inline void _allocate(const ssize_t *shape_, const strided_array_padding &padding)
+    {
+	ssize_t a = padding.align_nbytes;
+	ssize_t b = padding.antialias_nbytes;
+
+	if ((a <= 0) || (a % sizeof(T)) || (b < 0) || (b % a))
+	    throw std::runtime_error("strided_array: invalid padding (align_nbytes must be a positive multiple of sizeof(T), antialias_nbytes must be a multiple of align_nbytes)");
+
+	for (int k = 0; k < N; k++) {
+	    if (shape_[k] <= 0)
+		throw std::runtime_error("strided_array: expected all dimensions to be > 0");
+	    this->shape[k] = shape_[k];
+	}
+
+	this->strides[N-1] = 1;
+
+	for (int k = N-2; k >= 0; k--) {
+	    ssize_t nbytes = this->shape[k+1] * this->strides[k+1] * sizeof(T);
+	    nbytes = ((nbytes + a - 1) / a) * a;
+
+	    if ((b > 0) && (nbytes % b == 0))
+		nbytes += a;
+
+	    this->strides[k] = nbytes / sizeof(T);
+	}
+
+	this->nalloc = this->shape[0] * this->strides[0];
+	this->ref = make_uptr<T> (nalloc, std::max(a, ssize_t(128)));
+	this->data = ref.get();
+    }
+};
+
+
+#endif  // _STRIDED_ARRAY_HPP
@@ -0,0 +1,117 @@
+// Standard benchmarks for the run-benchmarks suite (see benchmark_registry.hpp).
+// For full sweeps over working set sizes, see stream-benchmark and latency-benchmark.
+
+#include <random>
+#include <algorithm>
+
+#include "benchmark_registry.hpp"
+#include "memory_utils.hpp"
+#include "memory_kernels.hpp"
+
+using namespace std;
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// memory/stream: STREAM kernels (see memory_kernels.hpp) on per-thread arrays (params.nbytes = all three arrays).
+
+
+class stream_benchmark : public benchmark_thread {
+public:
+    // Prevents the read kernel from being optimized out.  Per-instance, since each thread writes its own.
+    volatile double sink = 0.0;
+
+    stream_benchmark(const shared_ptr<timing_thread_pool> &pool_, const benchmark_params &params_) :
+	benchmark_thread(pool_, params_)
+    { }
+
+    virtual void thread_body() override
+    {
+	const ssize_t n = max(params.nbytes / ssize_t(3 * sizeof(double)), ssize_t(1));
+	const double s = 3.0;
+
+	uptr<double> a = make_uptr<double> (n);
+	uptr<double> b = make_uptr<double> (n);
+	uptr<double> c = make_uptr<double> (n);
+
+	for (ssize_t i = 0; i < n; i++) {
+	    a[i] = 1.0;
+	    b[i] = 2.0;
+	}
+
+	double sum = 0.0;
+
+	for (int k = 0; k < STREAM_NKERNELS; k++) {
+	    this->name = stream_kernel_names[k];
+	    this->nbytes_accessed = stream_kernel_narrays[k] * n * sizeof(double);
+	    this->run_trials([&]() { sum += run_stream_kernel(k, a.get(), b.get(), c.get(), s, n); });
+	}
+
+	sink = sum;
+    }
+};
+
+static benchmark_registrar<stream_benchmark> reg_stream("memory/stream", "STREAM copy/scale/add/triad/read/write (as in stream-benchmark), per-thread arrays of total size nbytes");
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// memory/latency: dependent loads along a random cycle through the cache lines of params.nbytes.
+
+
+class latency_benchmark : public benchmark_thread {
+public:
+    static constexpr ssize_t nloads = 1 << 20;
+
+    // Prevents the chase from being optimized out (per-instance, like stream_benchmark::sink).
+    chase_node * volatile sink = nullptr;
+
+    latency_benchmark(const shared_ptr<timing_thread_pool> &pool_, const benchmark_params &params_) :
+	benchmark_thread(pool_, params_)
+    { }
+
+    virtual void thread_body() override
+    {
+	const ssize_t nnodes = max(params.nbytes / ssize_t(sizeof(chase_node)), ssize_t(2));
+
+	uptr<chase_node> nodes = make_uptr<chase_node> (nnodes);
+	std::mt19937 rng(12345 + thread_id);
+	make_chase_cycle(nodes.get(), nnodes, rng);
+
+	// Untimed pass, as in latency-benchmark.
+	chase_node *p = chase(nodes.get(), nnodes);
+
+	this->name = "chase";
+	this->run_trials([&]() { p = chase(p, nloads); });
+
+	sink = p;
+    }
+};
+
+static benchmark_registrar<latency_benchmark> reg_latency("memory/latency", "pointer-chasing latency over nbytes (as in latency-benchmark, 2^20 dependent loads per trial)");
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// sync/barrier: round trips through timing_thread_pool::wait_at_barrier().
+
+
+class barrier_benchmark : public benchmark_thread {
+public:
+    static constexpr int nbarriers = 1000;
+
+    barrier_benchmark(const shared_ptr<timing_thread_pool> &pool_, const benchmark_params &params_) :
+	benchmark_thread(pool_, params_)
+    { }
+
+    virtual void thread_body() override
+    {
+	this->name = "wait_at_barrier_x1000";
+	this->run_trials([this]() {
+	    for (int i = 0; i < nbarriers; i++)
+		pool->wait_at_barrier(0.0);
+	});
+    }
+};
+
+static benchmark_registrar<barrier_benchmark> reg_barrier("sync/barrier", "1000 round trips through wait_at_barrier() (barrier type set by -B)");
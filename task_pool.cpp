@@ -0,0 +1,330 @@
+#include <string>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include "task_pool.hpp"
+
+using namespace std;
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// chase_lev_deque
+
+
+chase_lev_deque::chase_lev_deque(int64_t capacity) :
+    top(0), bottom(0)
+{
+    if ((capacity <= 0) || (capacity & (capacity-1)))
+	throw runtime_error("chase_lev_deque: capacity must be a power of two");
+
+    rings.push_back(unique_ptr<ring> (new ring(capacity)));
+    array.store(rings.back().get());
+}
+
+
+chase_lev_deque::~chase_lev_deque() { }
+
+
+void chase_lev_deque::push(task_base *x)
+{
+    int64_t b = bottom.load(memory_order_relaxed);
+    int64_t t = top.load(memory_order_acquire);
+    ring *a = array.load(memory_order_relaxed);
+
+    if (b - t > a->capacity - 1) {
+	// Grow: copy live elements into a ring of twice the size.
+	ring *a2 = new ring(2 * a->capacity);
+	for (int64_t i = t; i < b; i++)
+	    a2->put(i, a->get(i));
+
+	rings.push_back(unique_ptr<ring> (a2));
+	array.store(a2, memory_order_release);
+	a = a2;
+    }
+
+    a->put(b, x);
+    atomic_thread_fence(memory_order_release);
+    bottom.store(b+1, memory_order_relaxed);
+}
+
+
+task_base *chase_lev_deque::pop()
+{
+    int64_t b = bottom.load(memory_order_relaxed) - 1;
+    ring *a = array.load(memory_order_relaxed);
+    bottom.store(b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = top.load(memory_order_relaxed);
+
+    if (t > b) {
+	// Empty
+	bottom.store(b+1, memory_order_relaxed);
+	return nullptr;
+    }
+
+    task_base *x = a->get(b);
+
+    if (t == b) {
+	// Last element: race against thieves.
+	if (!top.compare_exchange_strong(t, t+1, memory_order_seq_cst, memory_order_relaxed))
+	    x = nullptr;
+	bottom.store(b+1, memory_order_relaxed);
+    }
+
+    return x;
+}
+
+
+task_base *chase_lev_deque::steal()
+{
+    int64_t t = top.load(memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = bottom.load(memory_order_acquire);
+
+    if (t >= b)
+	return nullptr;
+
+    ring *a = array.load(memory_order_acquire);
+    task_base *x = a->get(t);
+
+    if (!top.compare_exchange_strong(t, t+1, memory_order_seq_cst, memory_order_relaxed))
+	return nullptr;
+
+    return x;
+}
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// task_pool
+
+
+// Pool and worker index of the calling thread (if it is a worker thread).
+static thread_local const task_pool *tl_pool = nullptr;
+static thread_local int tl_worker = -1;
+
+
+task_pool::task_pool(int nworkers_, pinning_policy pinning, const vector<int> &explicit_cpus, bool pin) :
+    nworkers(nworkers_),
+    cpus(get_pinning(pinning, max(nworkers_,1), explicit_cpus)),
+    nqueued(0), nunfinished(0), nsleepers(0), shutdown(false)
+{
+    if (nworkers <= 0)
+	throw runtime_error("task_pool constructor called with nworkers <= 0");
+
+    for (int i = 0; i < nworkers; i++) {
+	workers.push_back(unique_ptr<worker_state> (new worker_state));
+	workers[i]->rng_state = 0x9e3779b97f4a7c15ULL * (i+1);
+    }
+
+    for (int i = 0; i < nworkers; i++)
+	threads.push_back(std::thread(&task_pool::_worker_main, this, i, pin));
+}
+
+
+task_pool::~task_pool()
+{
+    // A worker can't wait for its own task to finish, or join itself.  Since destructors are noexcept,
+    // the best we can do is fail with a clear message (rather than an uncaught exception from wait_all()).
+    if (current_worker() >= 0) {
+	cerr << "fatal: task_pool destroyed from one of its own worker threads"
+	     << " (the last reference to a task_pool must be dropped on a non-worker thread)" << endl;
+	abort();
+    }
+
+    wait_all();
+
+    {
+	lock_guard<mutex> l(sleep_lock);
+	shutdown.store(true);
+	sleep_cv.notify_all();
+    }
+
+    for (auto &t: threads)
+	t.join();
+}
+
+
+int task_pool::current_worker() const
+{
+    return (tl_pool == this) ? tl_worker : -1;
+}
+
+
+void task_pool::_submit(task_base *t)
+{
+    int w = current_worker();
+
+    // Increment counters before the task becomes visible, so they never go negative.
+    // The nqueued/nsleepers logic pairs with _worker_main().
+    nunfinished++;
+    nqueued++;
+
+    if (w >= 0)
+	workers[w]->deque.push(t);
+    else {
+	lock_guard<mutex> l(injection_lock);
+	injection_queue.push_back(t);
+    }
+
+    if (nsleepers.load() > 0) {
+	lock_guard<mutex> l(sleep_lock);
+	sleep_cv.notify_one();
+    }
+}
+
+
+void task_pool::_submit_to(int iworker, task_base *t)
+{
+    if ((iworker < 0) || (iworker >= nworkers)) {
+	delete t;
+	throw runtime_error("task_pool::submit_to(): iworker=" + to_string(iworker) + " is out of range");
+    }
+
+    worker_state &w = *workers[iworker];
+    nunfinished++;
+
+    {
+	lock_guard<mutex> l(w.mailbox_lock);
+	w.mailbox.push_back(t);
+	w.nmailbox++;
+    }
+
+    // We don't know which sleeper is 'iworker', so wake all of them.
+    if (nsleepers.load() > 0) {
+	lock_guard<mutex> l(sleep_lock);
+	sleep_cv.notify_all();
+    }
+}
+
+
+task_base *task_pool::_find_task(int iworker)
+{
+    task_base *t = nullptr;
+
+    // 0. Own mailbox (tasks from submit_to()).
+    if ((iworker >= 0) && (workers[iworker]->nmailbox.load() > 0)) {
+	worker_state &w = *workers[iworker];
+	lock_guard<mutex> l(w.mailbox_lock);
+
+	if (w.mailbox.size() > 0) {
+	    w.nmailbox--;
+	    t = w.mailbox.front();
+	    w.mailbox.pop_front();
+	    return t;
+	}
+    }
+
+    // 1. Own deque (LIFO).
+    if (iworker >= 0)
+	t = workers[iworker]->deque.pop();
+
+    // 2. Injection queue.
+    if (!t) {
+	lock_guard<mutex> l(injection_lock);
+	if (injection_queue.size() > 0) {
+	    t = injection_queue.front();
+	    injection_queue.pop_front();
+	}
+    }
+
+    // 3. Steal from random victims (FIFO).
+    if (!t && (nworkers > 1) && (iworker >= 0)) {
+	uint64_t &s = workers[iworker]->rng_state;
+
+	for (int i = 0; !t && (i < 2 * nworkers); i++) {
+	    // xorshift64
+	    s ^= s << 13;
+	    s ^= s >> 7;
+	    s ^= s << 17;
+
+	    int victim = s % nworkers;
+	    if (victim != iworker)
+		t = workers[victim]->deque.steal();
+	}
+    }
+
+    if (t)
+	nqueued--;
+
+    return t;
+}
+
+
+void task_pool::_run(task_base *t)
+{
+    // Exceptions are captured by packaged_task and rethrown from future::get().
+    t->run();
+    delete t;
+
+    if (--nunfinished == 0) {
+	lock_guard<mutex> l(sleep_lock);
+	done_cv.notify_all();
+    }
+}
+
+
+bool task_pool::_run_one(int iworker)
+{
+    task_base *t = _find_task(iworker);
+
+    if (!t)
+	return false;
+
+    _run(t);
+    return true;
+}
+
+
+void task_pool::_worker_main(int iworker, bool pin)
+{
+    tl_pool = this;
+    tl_worker = iworker;
+
+    if (pin)
+	pin_current_thread_to_core(cpus[iworker]);
+
+    for (;;) {
+	if (_run_one(iworker))
+	    continue;
+
+	// Spin briefly before sleeping.
+	std::atomic<int64_t> &nmailbox = workers[iworker]->nmailbox;
+	bool found = false;
+
+	for (int i = 0; !found && (i < 1000); i++) {
+	    if ((nqueued.load(memory_order_relaxed) > 0) || (nmailbox.load(memory_order_relaxed) > 0))
+		found = true;
+	    else
+		std::this_thread::yield();
+	}
+
+	if (found)
+	    continue;
+
+	unique_lock<mutex> l(sleep_lock);
+	nsleepers++;
+
+	while ((nqueued.load() == 0) && (nmailbox.load() == 0) && !shutdown.load())
+	    sleep_cv.wait(l);
+
+	nsleepers--;
+
+	if (shutdown.load() && (nqueued.load() == 0) && (nmailbox.load() == 0))
+	    return;
+    }
+}
+
+
+void task_pool::wait_all()
+{
+    // The calling task would count as unfinished, so this would never return.
+    if (current_worker() >= 0)
+	throw runtime_error("task_pool::wait_all() called from a worker thread (use task_pool::wait() instead)");
+
+    unique_lock<mutex> l(sleep_lock);
+
+    while (nunfinished.load() > 0)
+	done_cv.wait(l);
+}
@@ -0,0 +1,194 @@
+#ifndef _TASK_POOL_HPP
+#define _TASK_POOL_HPP
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <condition_variable>
+
+#include "timing_thread.hpp"
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// task_pool: a persistent pool of pinned worker threads, with work stealing.
+//
+//   task_pool pool(nworkers, PIN_PHYSICAL_CORES);
+//
+//   std::future<double> f = pool.submit([]() { return compute(); });
+//   double x = pool.wait(f);
+//
+//   pool.wait_all();    // waits for all submitted tasks
+//
+//   pool.submit_to(3, f);   // runs on worker 3 only (never stolen)
+//
+// Each worker has its own Chase-Lev deque.  Tasks submitted from a worker (e.g. a task which spawns
+// subtasks) go onto that worker's deque, and are run LIFO by the owner; idle workers steal FIFO from
+// random victims.  Tasks submitted from outside the pool go onto a shared injection queue.  Idle
+// workers spin briefly, then sleep on a condition variable.
+//
+// Worker threads are pinned using the same topology/pinning code as timing_thread_pool (see
+// get_pinning() in timing_thread.hpp).
+//
+// Calling future::get() from inside a task can deadlock (all workers may be waiting); use
+// task_pool::wait() instead, which runs other tasks while waiting.
+
+
+struct task_base {
+    virtual ~task_base() { }
+    virtual void run() = 0;
+};
+
+
+// Chase-Lev work-stealing deque (Le, Pop, Cohen & Zappa Nardelli, PPoPP 2013).
+// push() and pop() may only be called by the owning thread; steal() may be called by any thread.
+class chase_lev_deque {
+public:
+    chase_lev_deque(int64_t capacity=1024);
+    ~chase_lev_deque();
+
+    void push(task_base *t);
+    task_base *pop();      // returns nullptr if empty
+    task_base *steal();    // returns nullptr if empty, or if another thread won a race
+
+protected:
+    struct ring {
+	int64_t capacity;    // power of two
+	std::unique_ptr<std::atomic<task_base *>[]> buf;
+
+	ring(int64_t capacity_) : capacity(capacity_), buf(new std::atomic<task_base *>[capacity_]) { }
+	task_base *get(int64_t i) const { return buf[i & (capacity-1)].load(std::memory_order_relaxed); }
+	void put(int64_t i, task_base *t) { buf[i & (capacity-1)].store(t, std::memory_order_relaxed); }
+    };
+
+    char _pad0[64];
+    std::atomic<int64_t> top;
+    char _pad1[64];
+    std::atomic<int64_t> bottom;
+    std::atomic<ring *> array;
+    char _pad2[64];
+
+    // Old rings can't be freed while a thief might still be reading them, so we keep them until destruction.
+    std::vector<std::unique_ptr<ring>> rings;
+};
+
+
+class task_pool {
+public:
+    const int nworkers;
+    const std::vector<int> cpus;    // worker i is pinned to cpus[i] (if 'pin' was true)
+
+    task_pool(int nworkers, pinning_policy pinning=PIN_SEQUENTIAL, const std::vector<int> &explicit_cpus=std::vector<int>(), bool pin=true);
+
+    // Waits for all tasks, then joins worker threads.  Must be called from a non-worker thread: if
+    // a task drops the last reference to its own pool, the destructor prints an error and aborts.
+    ~task_pool();
+
+    // Noncopyable
+    task_pool(const task_pool &) = delete;
+    task_pool &operator=(const task_pool &) = delete;
+
+    template<typename F>
+    auto submit(F f) -> std::future<decltype(f())>
+    {
+	typedef decltype(f()) R;
+	std::packaged_task<R()> pt(std::move(f));
+	std::future<R> ret = pt.get_future();
+	_submit(new _task<R> (std::move(pt)));
+	return ret;
+    }
+
+    // Like submit(), but the task is only run by worker 'iworker' (e.g. so that it runs on a
+    // known cpu, for NUMA locality).  Such tasks are never stolen.
+    template<typename F>
+    auto submit_to(int iworker, F f) -> std::future<decltype(f())>
+    {
+	typedef decltype(f()) R;
+	std::packaged_task<R()> pt(std::move(f));
+	std::future<R> ret = pt.get_future();
+	_submit_to(iworker, new _task<R> (std::move(pt)));
+	return ret;
+    }
+
+    // Waits for a future and returns its value (or rethrows its exception).  If called from a worker
+    // thread of this pool, runs other tasks while waiting.
+    template<typename R>
+    R wait(std::future<R> &f)
+    {
+	wait_until_ready(f);
+	return f.get();
+    }
+
+    // Like wait(), but doesn't call future::get().
+    template<typename R>
+    void wait_until_ready(const std::future<R> &f)
+    {
+	int w = current_worker();
+
+	if (w < 0) {
+	    f.wait();
+	    return;
+	}
+
+	while (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+	    if (!_run_one(w))
+		std::this_thread::yield();
+    }
+
+    // Waits until all submitted tasks have completed (including tasks submitted while waiting).
+    void wait_all();
+
+    // Returns index of calling worker thread in this pool, or -1 if called from a non-worker thread.
+    int current_worker() const;
+
+protected:
+    template<typename R>
+    struct _task : public task_base {
+	std::packaged_task<R()> pt;
+	_task(std::packaged_task<R()> &&pt_) : pt(std::move(pt_)) { }
+	virtual void run() override { pt(); }
+    };
+
+    struct worker_state {
+	chase_lev_deque deque;
+	uint64_t rng_state = 0;
+
+	// Mailbox for submit_to().
+	std::mutex mailbox_lock;
+	std::deque<task_base *> mailbox;
+	std::atomic<int64_t> nmailbox;
+
+	worker_state() : nmailbox(0) { }
+    };
+
+    std::vector<std::unique_ptr<worker_state>> workers;
+    std::vector<std::thread> threads;
+
+    // Injection queue, for tasks submitted from outside the pool.
+    std::mutex injection_lock;
+    std::deque<task_base *> injection_queue;
+
+    std::atomic<int64_t> nqueued;        // tasks in deques or injection queue (not mailboxes)
+    std::atomic<int64_t> nunfinished;    // tasks submitted but not yet completed
+    std::atomic<int> nsleepers;
+    std::atomic<bool> shutdown;
+
+    std::mutex sleep_lock;
+    std::condition_variable sleep_cv;    // workers wait here when idle
+    std::condition_variable done_cv;     // wait_all() waits here
+
+    void _submit(task_base *t);
+    void _submit_to(int iworker, task_base *t);
+    void _worker_main(int iworker, bool pin);
+    task_base *_find_task(int iworker);
+    bool _run_one(int iworker);
+    void _run(task_base *t);
+};
+
+
+#endif  // _TASK_POOL_HPP
@@ -1,6 +1,16 @@
+#ifndef _TIME_HPP
+#define _TIME_HPP
+
+#include <time.h>
+#include <stdint.h>
 #include <sys/time.h>
 #include <stdexcept>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
 inline double time_diff(const struct timeval &tv1, const struct timeval &tv2)
 {
     return (tv2.tv_sec - tv1.tv_sec) + 1.0e-6 * (tv2.tv_usec - tv1.tv_usec);
@@ -13,3 +23,35 @@ inline struct timeval get_time()
         throw std::runtime_error("gettimeofday() failed");
     return ret;
 }
+
+
+// Monotonic clock with nanosecond resolution.  Unlike gettimeofday(), this is unaffected by
+// NTP adjustments, and is the right choice for timing short intervals.
+inline int64_t get_monotonic_ns()
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        throw std::runtime_error("clock_gettime() failed");
+    return int64_t(ts.tv_sec) * 1000000000L + ts.tv_nsec;
+}
+
+inline double get_monotonic_time()
+{
+    return 1.0e-9 * get_monotonic_ns();
+}
+
+
+// Reads the CPU timestamp counter (x86 only; always returns 0 on other architectures).
+// The tick rate must be calibrated against get_monotonic_ns(), see get_tsc_ticks_per_second()
+// in timing_thread.hpp.
+inline uint64_t read_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+
+#endif  // _TIME_HPP
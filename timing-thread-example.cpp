@@ -22,10 +22,18 @@ public:
 	this->stop_timer();
     }
 
+    // Repeated trials: prints min/median/p99/stddev over trials.
+    void time_short_sleep()
+    {
+	this->name = "time_short_sleep";
+	this->run_trials(20, [this]() { usleep(100 * (this->thread_id + 1)); });
+    }
+
     virtual void thread_body() override
     {
 	this->time_sleep();
 	this->time_sleep();
+	this->time_short_sleep();
     }
 };
 
@@ -41,5 +49,7 @@ int main(int argc, char **argv)
     for (int i = 0; i < nthreads; i++)
 	threads[i].join();
 
+    pool->print_barrier_skew();
+
     return 0;
 }
@@ -1,53 +1,190 @@
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <tuple>
 #include <string>
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
-#include <sys/time.h>
+#include <climits>
 #include <unistd.h>
 #include <pthread.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
 #include "timing_thread.hpp"
+#include "trace.hpp"
+#include "time.hpp"
 
 using namespace std;
 
 
-static void pin_current_thread_to_core(int core_id)
+// Runs 'niter' iterations of a dependent chain of adds, which executes at ~1 iteration per
+// clock cycle on current CPUs.  The empty asm prevents the compiler from optimizing it out
+// (or vectorizing it).  Returns elapsed time in seconds.
+static double timed_add_chain(long niter)
 {
-#ifdef __APPLE__
-    if (core_id == 0)
-	cerr << "warning: pinning threads to cores is not implemented in osx\n";
-    return;
-#else
-    int hwcores = std::thread::hardware_concurrency();
-    
-    if ((core_id < 0) || (core_id >= hwcores))
-	throw runtime_error("pin_thread_to_core: core_id=" + to_string(core_id) + " is out of range (hwcores=" + to_string(hwcores) + ")");
+    int64_t t0 = get_monotonic_ns();
+
+    long x = 0;
+    for (long i = 0; i < niter; i++) {
+	x += i;
+	asm volatile("" : "+r" (x));
+    }
+
+    return 1.0e-9 * (get_monotonic_ns() - t0);
+}
 
-    pthread_t thread = pthread_self();
 
-    cpu_set_t cs;
-    CPU_ZERO(&cs);
-    CPU_SET(core_id, &cs);
+// Returns current frequency of the calling thread's cpu in GHz, from cpufreq, or 0 if unavailable.
+static double read_cpufreq_ghz()
+{
+#ifdef __APPLE__
+    return 0.0;
+#else
+    int cpu = sched_getcpu();
+    if (cpu < 0)
+	return 0.0;
 
-    int err = pthread_setaffinity_np(thread, sizeof(cs), &cs);
-    if (err)
-        throw runtime_error("pthread_setaffinity_np() failed");
+    int khz = read_int_from_file("/sys/devices/system/cpu/cpu" + to_string(cpu) + "/cpufreq/scaling_cur_freq");
+    return (khz > 0) ? (1.0e-6 * khz) : 0.0;
 #endif
 }
 
 
-void warm_up_cpu()
+warm_up_result warm_up_cpu(double tolerance, double max_seconds)
 {
-    // A throwaway computation which uses the CPU for ~10^9
-    // clock cycles.  The details (usleep, xor) are to prevent the
-    // compiler from optimizing it out!
+    // Runs the CPU until its clock rate stabilizes, since without warm-up the CPU
+    // may run slow for a while (power-saving states, turbo ramp-up).
     //
-    // Empirically, this makes timing results more stable (without it,
-    // the CPU seems to run slow for the first ~10^9 cycles or so.)
+    // We measure the effective clock rate by timing short add-chain loops (~2 ms each),
+    // and declare convergence when the last 'nwindow' rates agree to within 'tolerance'.
+
+    const int nwindow = 5;
+    const double chunk_seconds = 2.0e-3;
+
+    int64_t t0 = get_monotonic_ns();
+    warm_up_result ret;
+
+    // Calibrate chunk size.
+    long niter = 100000;
+    while (timed_add_chain(niter) < 0.2 * chunk_seconds)
+	niter *= 2;
+
+    vector<double> rates;
+
+    for (;;) {
+	double dt = timed_add_chain(niter);
+	rates.push_back(niter / dt);
+	ret.elapsed = 1.0e-9 * (get_monotonic_ns() - t0);
 
-    long n = 0;
-    for (long i = 0; i < 1000L * 1000L * 1000L; i++)
-	n += (i ^ (i-1));
-    usleep(n % 2);
+	// Adjust chunk size toward chunk_seconds (rate may have changed since calibration).
+	niter = max(1000L, long(niter * chunk_seconds / max(dt, 1.0e-6)));
+
+	// Checked before convergence, so that a converged result always has elapsed <= max_seconds.
+	if (ret.elapsed > max_seconds)
+	    break;
+
+	if ((int)rates.size() >= nwindow) {
+	    auto w0 = rates.end() - nwindow;
+	    double rmin = *std::min_element(w0, rates.end());
+	    double rmax = *std::max_element(w0, rates.end());
+
+	    if (rmax - rmin <= tolerance * rmax) {
+		ret.converged = true;
+		break;
+	    }
+	}
+    }
+
+    ret.ghz = 1.0e-9 * rates.back();
+    ret.cpufreq_ghz = read_cpufreq_ghz();
+    return ret;
+}
+
+
+void print_warm_up_result(const warm_up_result &r, ostream &os)
+{
+    os << "warm_up_cpu: " << (r.converged ? "settled" : "did not settle") << " after " << (1000. * r.elapsed)
+       << " ms, effective clock " << r.ghz << " GHz";
+
+    if (r.cpufreq_ghz > 0.0)
+	os << " (cpufreq " << r.cpufreq_ghz << " GHz)";
+
+    os << endl;
+}
+
+
+double get_tsc_ticks_per_second()
+{
+    // Calibrated once (thread-safe in C++11), by comparing the TSC with the monotonic clock
+    // over ~20 ms.  We only trust the TSC if /proc/cpuinfo says it runs at a constant rate.
+    static double ret = []()
+    {
+	if (read_tsc() == 0)
+	    return 0.0;
+
+	FILE *fp = fopen("/proc/cpuinfo", "r");
+	if (!fp)
+	    return 0.0;
+
+	bool constant_tsc = false;
+	char line[4096];
+
+	while (!constant_tsc && fgets(line, sizeof(line), fp))
+	    if (!strncmp(line, "flags", 5) && strstr(line, " constant_tsc") && strstr(line, " nonstop_tsc"))
+		constant_tsc = true;
+
+	fclose(fp);
+
+	if (!constant_tsc)
+	    return 0.0;
+
+	int64_t ns0 = get_monotonic_ns();
+	uint64_t t0 = read_tsc();
+	usleep(20000);
+	int64_t ns1 = get_monotonic_ns();
+	uint64_t t1 = read_tsc();
+
+	return 1.0e9 * double(t1 - t0) / double(ns1 - ns0);
+    }();
+
+    return ret;
+}
+
+
+timing_statistics compute_timing_statistics(const vector<double> &samples)
+{
+    timing_statistics ret;
+    ret.ntrials = samples.size();
+
+    if (ret.ntrials == 0)
+	return ret;
+
+    vector<double> v = samples;
+    std::sort(v.begin(), v.end());
+
+    ssize_t n = ret.ntrials;
+    double sum = 0.0, sum2 = 0.0;
+
+    for (double t: v)
+	sum += t;
+
+    ret.mean = sum / n;
+
+    for (double t: v)
+	sum2 += (t - ret.mean) * (t - ret.mean);
+
+    // p99 uses the nearest-rank definition.
+    ret.min = v[0];
+    ret.median = (n % 2) ? v[n/2] : (0.5 * (v[n/2-1] + v[n/2]));
+    ret.p99 = v[std::min(n-1, ssize_t(ceil(0.99 * n)) - 1)];
+    ret.stddev = (n > 1) ? sqrt(sum2 / (n-1)) : 0.0;
+
+    return ret;
 }
 
 
@@ -56,11 +193,100 @@ void warm_up_cpu()
 // timing_thread_pool
 
 
-timing_thread_pool::timing_thread_pool(int nthreads_) :
-    nthreads(nthreads_)
+timing_thread_pool::timing_thread_pool(int nthreads_, timer_type timer_, barrier_type barrier_, pinning_policy pinning_, const vector<int> &explicit_cpus) :
+    nthreads(nthreads_),
+    timer((timer_ == TIMER_TSC) && (get_tsc_ticks_per_second() > 0.0) ? TIMER_TSC : TIMER_MONOTONIC),
+    barrier(barrier_),
+    pinning(pinning_),
+    cpus(get_pinning(pinning_, max(nthreads_,1), explicit_cpus)),
+    spin_ticket(0), spin_arrived(0), spin_gen(0), spin_nsleepers(0)
 { 
     if (nthreads <= 0)
 	throw runtime_error("timing_thread_pool constructor called with nthreads <= 0");
+    if ((timer_ != TIMER_MONOTONIC) && (timer_ != TIMER_TSC))
+	throw runtime_error("timing_thread_pool constructor: invalid timer_type");
+    if ((barrier != BARRIER_MUTEX) && (barrier != BARRIER_SPIN) && (barrier != BARRIER_HYBRID))
+	throw runtime_error("timing_thread_pool constructor: invalid barrier_type");
+
+    if (timer == TIMER_TSC)
+	this->tick_seconds = 1.0 / get_tsc_ticks_per_second();
+
+    this->barrier_tvals.reset(new double[nthreads]);
+    this->exit_ticks.reset(new int64_t[nthreads]);
+    this->interference_reports.resize(nthreads);
+    this->perf_values.resize(nthreads, std::array<double,PERF_NCOUNTERS> ());
+}
+
+
+int64_t timing_thread_pool::get_ticks() const
+{
+    return (timer == TIMER_TSC) ? int64_t(read_tsc()) : get_monotonic_ns();
+}
+
+
+void timing_thread_pool::record_sample(const string &name, double dt, ssize_t nbytes_accessed, bool interference)
+{
+    lock_guard<mutex> l(sample_lock);
+
+    sample_nbytes[name] = nbytes_accessed;
+    sample_nflagged[name] += interference ? 1 : 0;
+
+    auto p = samples.find(name);
+
+    if (p == samples.end()) {
+	sample_names.push_back(name);
+	samples[name] = { dt };
+    }
+    else
+	p->second.push_back(dt);
+}
+
+
+vector<double> timing_thread_pool::get_samples(const string &name) const
+{
+    lock_guard<mutex> l(sample_lock);
+
+    auto p = samples.find(name);
+    return (p != samples.end()) ? p->second : vector<double> ();
+}
+
+
+vector<string> timing_thread_pool::get_sample_names() const
+{
+    lock_guard<mutex> l(sample_lock);
+    return sample_names;
+}
+
+
+ssize_t timing_thread_pool::get_nbytes_accessed(const string &name) const
+{
+    lock_guard<mutex> l(sample_lock);
+
+    auto p = sample_nbytes.find(name);
+    return (p != sample_nbytes.end()) ? p->second : 0;
+}
+
+
+ssize_t timing_thread_pool::get_num_interference_flagged(const string &name) const
+{
+    lock_guard<mutex> l(sample_lock);
+
+    auto p = sample_nflagged.find(name);
+    return (p != sample_nflagged.end()) ? p->second : 0;
+}
+
+
+static void print_timing_statistics(ostream &os, const string &name, const timing_statistics &s)
+{
+    os << name << ": " << s.ntrials << " trials, min " << s.min << ", median " << s.median
+       << ", p99 " << s.p99 << ", stddev " << s.stddev << " seconds" << endl;
+}
+
+
+void timing_thread_pool::print_statistics(ostream &os) const
+{
+    for (const string &name: get_sample_names())
+	print_timing_statistics(os, name, compute_timing_statistics(get_samples(name)));
 }
 
 
@@ -72,19 +298,68 @@ int timing_thread_pool::get_and_increment_thread_id()
 
 
 double timing_thread_pool::wait_at_barrier(double t)
+{
+    if (barrier == BARRIER_MUTEX)
+	_wait_at_mutex_barrier(t, -1);
+    else
+	_wait_at_spin_barrier(t, -1);
+
+    return barrier_result.mean;
+}
+
+
+const barrier_reduction &timing_thread_pool::reduce_at_barrier(double t, int thread_id)
+{
+    if ((thread_id < 0) || (thread_id >= nthreads))
+	throw runtime_error("timing_thread_pool::reduce_at_barrier(): thread_id out of range");
+
+    if (barrier == BARRIER_MUTEX)
+	_wait_at_mutex_barrier(t, thread_id);
+    else
+	_wait_at_spin_barrier(t, thread_id);
+
+    return barrier_result;
+}
+
+
+// Called by the last thread to arrive at a barrier.
+void timing_thread_pool::_reduce_barrier_tvals()
+{
+    barrier_reduction &r = barrier_result;
+    r.tvals.assign(&barrier_tvals[0], &barrier_tvals[0] + nthreads);
+    r.argmin = r.argmax = 0;
+
+    double tsum = 0.0;
+    for (int i = 0; i < nthreads; i++) {
+	tsum += r.tvals[i];
+	if (r.tvals[i] < r.tvals[r.argmin])
+	    r.argmin = i;
+	if (r.tvals[i] > r.tvals[r.argmax])
+	    r.argmax = i;
+    }
+
+    r.mean = tsum / nthreads;
+    r.min = r.tvals[r.argmin];
+    r.max = r.tvals[r.argmax];
+}
+
+
+void timing_thread_pool::_wait_at_mutex_barrier(double t, int slot)
 {
     unique_lock<mutex> l(barrier_lock);
 
-    barrier_tcurr += t;
+    int ticket = barrier_count;
+    barrier_tvals[(slot >= 0) ? slot : ticket] = t;
     barrier_count++;
     
     if (barrier_count == nthreads) {
-	barrier_tprev = barrier_tcurr;
-	barrier_tcurr = 0.0;
+	_update_barrier_skew();
+	_reduce_barrier_tvals();
 	barrier_count = 0;
 	barrier_gen++;
 	barrier_cv.notify_all();
-	return barrier_tprev / nthreads;
+	exit_ticks[ticket] = get_ticks();
+	return;
     }
     
     int g = barrier_gen;
@@ -92,7 +367,273 @@ double timing_thread_pool::wait_at_barrier(double t)
     while (barrier_gen == g)
 	barrier_cv.wait(l);
 
-    return barrier_tprev / nthreads;
+    exit_ticks[ticket] = get_ticks();
+}
+
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+
+static inline void futex_wait(atomic<int> &word, int val)
+{
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<int *> (&word), FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+    std::this_thread::yield();
+#endif
+}
+
+
+static inline void futex_wake_all(atomic<int> &word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<int *> (&word), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+
+void timing_thread_pool::_wait_at_spin_barrier(double t, int slot)
+{
+    // We can read spin_gen before arriving: it can't advance until this thread has arrived.
+    int g = spin_gen.load(memory_order_acquire);
+    int ticket = spin_ticket.fetch_add(1, memory_order_relaxed);
+
+    barrier_tvals[(slot >= 0) ? slot : ticket] = t;
+
+    if (spin_arrived.fetch_add(1, memory_order_acq_rel) == nthreads-1) {
+	_update_barrier_skew();
+	_reduce_barrier_tvals();
+	spin_ticket.store(0, memory_order_relaxed);
+	spin_arrived.store(0, memory_order_relaxed);
+	spin_gen.store(g+1);    // seq_cst, pairs with spin_nsleepers below
+
+	if (spin_nsleepers.load() > 0)
+	    futex_wake_all(spin_gen);
+    }
+    else if (barrier == BARRIER_SPIN) {
+	while (spin_gen.load(memory_order_acquire) == g)
+	    cpu_relax();
+    }
+    else {
+	// BARRIER_HYBRID: spin for a few microseconds before sleeping.
+	for (int i = 0; (i < 4096) && (spin_gen.load(memory_order_acquire) == g); i++)
+	    cpu_relax();
+
+	if (spin_gen.load(memory_order_acquire) == g) {
+	    spin_nsleepers++;
+	    while (spin_gen.load() == g)
+		futex_wait(spin_gen, g);
+	    spin_nsleepers--;
+	}
+    }
+
+    exit_ticks[ticket] = get_ticks();
+}
+
+
+// Called by the last thread to arrive at a barrier, when all threads have recorded
+// their exit times from the previous barrier.
+void timing_thread_pool::_update_barrier_skew()
+{
+    if (exit_ticks_valid) {
+	int64_t tmin = exit_ticks[0];
+	int64_t tmax = exit_ticks[0];
+
+	for (int i = 1; i < nthreads; i++) {
+	    tmin = min(tmin, exit_ticks[i]);
+	    tmax = max(tmax, exit_ticks[i]);
+	}
+
+	double skew = (tmax - tmin) * tick_seconds;
+	skew_count++;
+	skew_sum += skew;
+	skew_max = max(skew_max, skew);
+    }
+
+    this->exit_ticks_valid = true;
+}
+
+
+barrier_skew_stats timing_thread_pool::get_barrier_skew() const
+{
+    barrier_skew_stats ret;
+    ret.nbarriers = skew_count;
+    ret.mean_skew = skew_count ? (skew_sum / skew_count) : 0.0;
+    ret.max_skew = skew_max;
+    return ret;
+}
+
+
+void timing_thread_pool::print_barrier_skew(ostream &os) const
+{
+    barrier_skew_stats s = get_barrier_skew();
+
+    os << "barrier exit skew: " << s.nbarriers << " barriers, mean " << (1.0e6 * s.mean_skew)
+       << " usec, max " << (1.0e6 * s.max_skew) << " usec" << endl;
+}
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// allreduce_tree
+
+
+allreduce_tree::allreduce_tree(const vector<cpu_info> &thread_cpus, int max_fanin_, ssize_t value_nbytes) :
+    nthreads(thread_cpus.size()),
+    max_fanin(max_fanin_),
+    gen(0), nsleepers(0)
+{
+    if (nthreads <= 0)
+	throw runtime_error("allreduce_tree constructor called with empty 'thread_cpus'");
+    if (max_fanin < 2)
+	throw runtime_error("allreduce_tree constructor: max_fanin must be >= 2");
+
+    leaf_node.resize(nthreads, -1);
+    leaf_slot.resize(nthreads, 0);
+
+    // Threads sorted by (package, core), so that SMT siblings and cores of a package are adjacent.
+    vector<tuple<int,int,int>> keys;
+    for (int i = 0; i < nthreads; i++)
+	keys.push_back(std::make_tuple(thread_cpus[i].package, thread_cpus[i].core, i));
+    std::sort(keys.begin(), keys.end());
+
+    // Level 1: threads on the same physical core.  Level 2: cores of a package.  Level 3: packages.
+    vector<int> core_items, package_items;
+
+    for (int i = 0; i < nthreads; ) {
+	int j = i;
+	vector<int> threads;
+	while ((j < nthreads) && (std::get<0> (keys[j]) == std::get<0> (keys[i])) && (std::get<1> (keys[j]) == std::get<1> (keys[i])))
+	    threads.push_back(-1 - std::get<2> (keys[j++]));
+
+	core_items.push_back(_combine(threads));
+
+	if ((j == nthreads) || (std::get<0> (keys[j]) != std::get<0> (keys[i]))) {
+	    package_items.push_back(_combine(core_items));
+	    core_items.clear();
+	}
+
+	i = j;
+    }
+
+    // Ensures a root node exists if nthreads=1.
+    if (_combine(package_items) < 0)
+	_make_node(package_items);
+
+    // Each node's values start on a new cache line.
+    int pad = (64 + value_nbytes - 1) / max(value_nbytes, ssize_t(1));
+
+    for (node &n: nodes) {
+	n.value_offset = nvalues;
+	nvalues += n.nchildren + pad;
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+	int d = 1;
+	for (int n = leaf_node[i]; nodes[n].parent >= 0; n = nodes[n].parent)
+	    d++;
+	tree_depth = max(tree_depth, d);
+    }
+
+    counters.reset(new padded_counter[nodes.size()]);
+    for (size_t n = 0; n < nodes.size(); n++)
+	counters[n].n.store(0);
+}
+
+
+vector<cpu_info> allreduce_tree::get_thread_cpus(const timing_thread_pool &pool)
+{
+    const cpu_topology &topo = get_cpu_topology();
+    vector<cpu_info> ret(pool.nthreads);
+
+    for (int i = 0; i < pool.nthreads; i++) {
+	for (const cpu_info &c: topo.cpus)
+	    if (c.cpu == pool.cpus[i])
+		ret[i] = c;
+    }
+
+    return ret;
+}
+
+
+int allreduce_tree::_make_node(const vector<int> &children)
+{
+    int n = nodes.size();
+    nodes.push_back(node());
+    nodes[n].nchildren = children.size();
+
+    for (size_t i = 0; i < children.size(); i++) {
+	int c = children[i];
+	if (c >= 0) {
+	    nodes[c].parent = n;
+	    nodes[c].slot = i;
+	}
+	else {
+	    leaf_node[-1-c] = n;
+	    leaf_slot[-1-c] = i;
+	}
+    }
+
+    return n;
+}
+
+
+// Combines 'items' into a single item, using nodes with at most max_fanin children (as evenly
+// sized as possible).  A single item is returned as-is (no node with one child).
+int allreduce_tree::_combine(const vector<int> &items_)
+{
+    vector<int> items = items_;
+
+    while (items.size() > 1) {
+	int n = items.size();
+	int nchunks = (n + max_fanin - 1) / max_fanin;
+	vector<int> next;
+
+	for (int i = 0; i < nchunks; i++) {
+	    vector<int> chunk(items.begin() + (i*n)/nchunks, items.begin() + ((i+1)*n)/nchunks);
+	    next.push_back((chunk.size() > 1) ? _make_node(chunk) : chunk[0]);
+	}
+
+	items.swap(next);
+    }
+
+    return (items.size() > 0) ? items[0] : -1;
+}
+
+
+void allreduce_tree::_check_thread_id(int thread_id) const
+{
+    if ((thread_id < 0) || (thread_id >= nthreads))
+	throw runtime_error("tree_allreduce::allreduce(): thread_id out of range");
+}
+
+
+void allreduce_tree::_release(int g)
+{
+    gen.store(g+1);    // seq_cst, pairs with nsleepers below
+
+    if (nsleepers.load() > 0)
+	futex_wake_all(gen);
+}
+
+
+void allreduce_tree::_wait(int g)
+{
+    // Spin for a few microseconds before sleeping (as in BARRIER_HYBRID).
+    for (int i = 0; (i < 4096) && (gen.load(memory_order_acquire) == g); i++)
+	cpu_relax();
+
+    if (gen.load(memory_order_acquire) == g) {
+	nsleepers++;
+	while (gen.load() == g)
+	    futex_wait(gen, g);
+	nsleepers--;
+    }
 }
 
 
@@ -106,8 +647,12 @@ timing_thread::timing_thread(const shared_ptr<timing_thread_pool> &pool_, bool p
     pinned_to_core(pin_to_core),
     call_warm_up_cpu(warm_up_cpu_),
     thread_id(pool_->get_and_increment_thread_id()),
-    nthreads(pool_->nthreads)
-{ }
+    nthreads(pool_->nthreads),
+    verbose(pool_->verbose)
+{
+    for (int i = 0; i < PERF_NCOUNTERS; i++)
+	perf_totals[i] = 0.0;
+}
 
 
 // static member function
@@ -116,12 +661,17 @@ void timing_thread::_thread_main(timing_thread *t)
     // Ensure delete(t) is called
     auto p = unique_ptr<timing_thread> (t);
 
+    set_trace_thread_name("timing_thread " + to_string(t->thread_id));
+
     if (t->pinned_to_core)
-	pin_current_thread_to_core(t->thread_id);
+	pin_current_thread_to_core(t->pool->cpus.at(t->thread_id));
 
     // Call after pinning thread
-    if (t->call_warm_up_cpu)
-	warm_up_cpu();
+    if (t->call_warm_up_cpu) {
+	t->warm_up = warm_up_cpu();
+	if ((t->thread_id == 0) && t->verbose)
+	    print_warm_up_result(t->warm_up);
+    }
 
     t->thread_body();
 }
@@ -129,7 +679,32 @@ void timing_thread::_thread_main(timing_thread *t)
 
 void timing_thread::start_timer()
 {
+    if (use_perf_counters) {
+	// Must be constructed on the thread being measured.
+	if (!perf) {
+	    perf.reset(new perf_counters);
+	    if (!perf->available() && (thread_id == 0))
+		cout << "warning: hardware counters unavailable: " << perf->error_message() << endl;
+	}
+	perf->reset();
+    }
+
+    TRACE_BEGIN("start_timer barrier");
     pool->wait_at_barrier();
+    TRACE_END("start_timer barrier");
+
+    // After the barrier, so that time spent waiting isn't included.
+    if (monitor_interference)
+	this->interference_start = take_interference_snapshot();
+
+    // Interned, since 'name' may change (or be destroyed) before the trace is written.  We only call
+    // trace_intern() (which takes a global lock) when 'name' changes, not on every trial.
+    if (trace_enabled() && (name != trace_region_name)) {
+	this->trace_region = trace_intern((name.size() > 0) ? name : "timed region");
+	this->trace_region_name = name;
+    }
+
+    TRACE_BEGIN(trace_region);
     
     this->local_dt = 0.0;
     this->unpause_timer();
@@ -139,32 +714,136 @@ void timing_thread::start_timer()
 void timing_thread::stop_timer()
 {
     this->pause_timer();
-    this->global_dt = pool->wait_at_barrier(local_dt);
+    TRACE_END(trace_region);
+
+    if (histogram)
+	histogram->record(int64_t(1.0e9 * local_dt), thread_id % histogram->nshards);
+
+    if (monitor_interference) {
+	interference_snapshot s = take_interference_snapshot();
+	pool->interference_reports.at(thread_id) = compare_interference_snapshots(interference_start, s, pool->interference_limits);
+    }
+
+    if (use_perf_counters)
+	perf->read(pool->perf_values.at(thread_id).data());
+
+    TRACE_BEGIN("stop_timer barrier");
+    // Copy-assignment reuses the capacity of dt_reduction.tvals, so this doesn't allocate after the first call.
+    this->dt_reduction = pool->reduce_at_barrier(local_dt, thread_id);
+    this->global_dt = dt_reduction.mean;
+    TRACE_END("stop_timer barrier");
+
+    if (use_perf_counters) {
+	// Written by each thread before the barrier, and not overwritten until after the next one.
+	for (int i = 0; i < PERF_NCOUNTERS; i++)
+	    perf_totals[i] = 0.0;
+	for (const auto &v: pool->perf_values)
+	    for (int i = 0; i < PERF_NCOUNTERS; i++)
+		perf_totals[i] += v[i];
+    }
 
     if ((thread_id != 0) || (name.size() == 0))
 	return;
 
+    this->_update_interference();
+    pool->record_sample(name, global_dt, nbytes_accessed, interference_description.size() > 0);
+
+    double imbalance = (global_dt > 0.0) ? (dt_reduction.max / global_dt) : 1.0;
+
+    if (!print_each_trial) {
+	// Inside run_trials(): accumulate imbalance stats for _print_trials().
+	trial_max_imbalance = max(trial_max_imbalance, imbalance);
+	trial_straggler_counts.at(dt_reduction.argmax)++;
+
+	if (interference_description.size() > 0) {
+	    if (trial_nflagged++ == 0)
+		trial_flagged_example = interference_description;
+	}
+	return;
+    }
+
+    if (!verbose)
+	return;
+
     cout << name << ": " << global_dt << " seconds";
 
     if (nbytes_accessed > 0)
 	cout << ", memory bandwidth " << (nbytes_accessed / global_dt / pow(2.,30.)) << " GB/sec";
     if (floating_point_ops > 0)
 	cout << ", gflops=" << (floating_point_ops / global_dt / pow(2.,30.));
+    if ((nthreads > 1) && (global_dt > 0.0)) {
+	cout << ", imbalance max/mean=" << imbalance << " min/mean=" << (dt_reduction.min / global_dt)
+	     << ", slowest " << _describe_thread(dt_reduction.argmax);
+    }
+    if (use_perf_counters)
+	_print_perf_totals();
+    if (interference_description.size() > 0)
+	cout << ", INTERFERENCE: " << interference_description;
 
     cout << endl;
 }
 
 
+// Called on thread ID zero in stop_timer(), after the barrier.
+void timing_thread::_update_interference()
+{
+    interference_description.clear();
+
+    if (!monitor_interference)
+	return;
+
+    for (int i = 0; i < nthreads; i++) {
+	const interference_report &r = pool->interference_reports[i];
+	if (!r.flagged)
+	    continue;
+	if (interference_description.size() > 0)
+	    interference_description += "; ";
+	interference_description += "thread " + to_string(i) + " " + r.describe(pool->interference_limits);
+    }
+}
+
+
+string timing_thread::_describe_thread(int id) const
+{
+    string ret = "thread " + to_string(id);
+    if (pinned_to_core)
+	ret += " (cpu " + to_string(pool->cpus.at(id)) + ")";
+    return ret;
+}
+
+
+void timing_thread::_print_perf_totals()
+{
+    // Availability is checked on thread 0 only (all threads run on the same hardware).
+    const double *v = perf_totals;
+    double kinstr = v[PERF_INSTRUCTIONS] / 1000.;
+
+    if (!perf->available(PERF_CYCLES) || !perf->available(PERF_INSTRUCTIONS)) {
+	cout << ", hardware counters unavailable";
+	return;
+    }
+
+    cout << ", IPC=" << (v[PERF_INSTRUCTIONS] / v[PERF_CYCLES]);
+
+    // Miss rates are per 1000 instructions.
+    for (int i: { PERF_LLC_MISSES, PERF_BRANCH_MISSES, PERF_DTLB_MISSES })
+	if (perf->available(i))
+	    cout << ", " << perf_counter_name(i) << "/kinstr=" << (v[i] / kinstr);
+}
+
+
 void timing_thread::pause_timer()
 {
     if (!timer_is_running)
 	throw runtime_error("timing_thread::stop_timer() or pause_timer() was called, but timer was already stopped");
 
-    struct timeval end_time;
-    gettimeofday(&end_time, NULL);
+    int64_t end_ticks = pool->get_ticks();
+
+    if (use_perf_counters)
+	perf->stop();
 
     // Note "+=" here.
-    this->local_dt += (end_time.tv_sec - start_time.tv_sec) + 1.0e-6 * (end_time.tv_usec - start_time.tv_usec);
+    this->local_dt += (end_ticks - start_ticks) * pool->seconds_per_tick();
     this->timer_is_running = false;
 }
 
@@ -173,6 +852,40 @@ void timing_thread::unpause_timer()
     if (timer_is_running)
 	throw runtime_error("timing_thread::start_timer() or unpause_timer() was called, but timer is already running");
     
-    gettimeofday(&this->start_time, NULL);
+    if (use_perf_counters)
+	perf->start();
+
+    this->start_ticks = pool->get_ticks();
     this->timer_is_running = true;
 }
+
+
+void timing_thread::_print_trials(int ntrials)
+{
+    if ((thread_id != 0) || (name.size() == 0) || (ntrials <= 0) || !verbose)
+	return;
+
+    vector<double> v = pool->get_samples(name);
+    ssize_t n = min(ssize_t(ntrials), ssize_t(v.size()));
+    v.erase(v.begin(), v.end() - n);
+
+    print_timing_statistics(cout, name, compute_timing_statistics(v));
+
+    if (nthreads > 1) {
+	vector<int> &c = trial_straggler_counts;
+	int straggler = std::max_element(c.begin(), c.end()) - c.begin();
+
+	cout << name << ": worst imbalance max/mean=" << trial_max_imbalance << ", slowest thread was "
+	     << _describe_thread(straggler) << " in " << c[straggler] << "/" << ntrials << " trials" << endl;
+    }
+
+    if (histogram) {
+	cout << name << ": per-thread latency histogram: ";
+	histogram->snapshot().print(cout, "usec", 1.0e-3);
+    }
+
+    if (trial_nflagged > 0) {
+	cout << name << ": " << trial_nflagged << "/" << ntrials << " trials flagged for interference (e.g. "
+	     << trial_flagged_example << ")" << endl;
+    }
+}
@@ -1,37 +1,397 @@
 #ifndef _TIMING_THREAD_HPP
 #define _TIMING_THREAD_HPP
 
+#include <map>
+#include <array>
+#include <string>
+#include <vector>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <iostream>
 #include <condition_variable>
+#include <stdint.h>
+
+#include "cpu_affinity.hpp"
+#include "perf_counters.hpp"
+#include "interference_monitor.hpp"
+#include "latency_histogram.hpp"
+
+
+// Rate of read_tsc() (see time.hpp), calibrated against the monotonic clock on first call.
+// Returns 0 if the timestamp counter is unavailable or not usable for timing.
+extern double get_tsc_ticks_per_second();
+
+
+// Adaptive CPU warm-up: runs short calibrated loops until the effective clock rate is stable
+// to within 'tolerance' (fractional), or until 'max_seconds' have elapsed.  Called by timing_thread
+// after pinning, if the 'warm_up_cpu' constructor argument is true.
+struct warm_up_result {
+    double elapsed = 0.0;       // seconds
+    double ghz = 0.0;           // effective clock rate, from loop timing
+    double cpufreq_ghz = 0.0;   // from /sys/devices/system/cpu/cpuN/cpufreq, or 0 if unavailable
+    bool converged = false;
+};
+
+extern warm_up_result warm_up_cpu(double tolerance=0.01, double max_seconds=2.0);
+extern void print_warm_up_result(const warm_up_result &r, std::ostream &os=std::cout);
+
+
+// Summary statistics over repeated trials of one benchmark (see timing_thread::run_trials()).
+struct timing_statistics {
+    ssize_t ntrials = 0;
+    double min = 0.0;
+    double median = 0.0;
+    double p99 = 0.0;
+    double mean = 0.0;
+    double stddev = 0.0;
+};
+
+extern timing_statistics compute_timing_statistics(const std::vector<double> &samples);
+
+
+// Clock used by timing_thread::start_timer() etc.
+//   TIMER_MONOTONIC: clock_gettime(CLOCK_MONOTONIC), nanosecond resolution, ~20 ns overhead.
+//   TIMER_TSC: calibrated CPU timestamp counter (x86 only, falls back to TIMER_MONOTONIC if unavailable).
+enum timer_type {
+    TIMER_MONOTONIC = 0,
+    TIMER_TSC = 1
+};
+
+
+// Barrier implementation used by timing_thread_pool::wait_at_barrier().
+//   BARRIER_MUTEX: mutex + condition_variable.  Cheap on CPU, but wake-up skew is tens of microseconds.
+//   BARRIER_SPIN: sense-reversing spin barrier on atomics.  Lowest skew, but burns a core per waiting thread.
+//   BARRIER_HYBRID: spins for a few microseconds, then sleeps on a futex (Linux; elsewhere, yields).
+enum barrier_type {
+    BARRIER_MUTEX = 0,
+    BARRIER_SPIN = 1,
+    BARRIER_HYBRID = 2
+};
+
+
+// Barrier exit skew: for each barrier, the spread (max - min) of the times at which threads
+// returned from wait_at_barrier().  Measured for every barrier except the first.
+struct barrier_skew_stats {
+    ssize_t nbarriers = 0;
+    double mean_skew = 0.0;   // seconds
+    double max_skew = 0.0;    // seconds
+};
+
+
+// Result of timing_thread_pool::reduce_at_barrier(): statistics of the t-values over threads.
+struct barrier_reduction {
+    double mean = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+    int argmin = 0;    // thread_id with the smallest t-value
+    int argmax = 0;    // thread_id with the largest t-value (e.g. the straggler, if t is a timing)
+
+    // Length-nthreads vector, indexed by thread_id.
+    std::vector<double> tvals;
+};
 
 
 class timing_thread_pool {
 public:
     const int nthreads;
+    const timer_type timer;
+    const barrier_type barrier;
+    const pinning_policy pinning;
+
+    // Length-nthreads vector: if a timing_thread is pinned, thread i is pinned to cpus[i].
+    const std::vector<int> cpus;
 
-    timing_thread_pool(int nthreads);
+    timing_thread_pool(int nthreads, timer_type timer=TIMER_MONOTONIC, barrier_type barrier=BARRIER_MUTEX,
+		       pinning_policy pinning=PIN_SEQUENTIAL, const std::vector<int> &explicit_cpus=std::vector<int>());
     
     // Helper function called by timing_thread.
     int get_and_increment_thread_id();
 
     // A "reducing" barrier.  When each thread arrives at the barrier, it
     // specifies a value of "t".  The return value from wait_at_barrier()
-    // is the mean (over all threads) of the t-values.
+    // is the mean (over all threads) of the t-values.  (To reduce other types, or
+    // with many threads, see tree_allreduce<T> below.)
     double wait_at_barrier(double t=0);
 
+    // Same barrier, but returns min/max/argmax and the per-thread t-values.  Every thread
+    // must pass its own (distinct) thread_id, in 0 <= thread_id < nthreads, and all threads
+    // must call reduce_at_barrier() (not wait_at_barrier()) at the same barrier.
+    //
+    // The returned reference is to a pool-owned result, which is valid until the calling thread
+    // arrives at the next barrier.  (Returning by value would allocate a copy of 'tvals' on every thread.)
+    const barrier_reduction &reduce_at_barrier(double t, int thread_id);
+
+    // Current time in clock ticks, and the duration of one tick in seconds.
+    int64_t get_ticks() const;
+    double seconds_per_tick() const { return tick_seconds; }
+
+    // Timing samples, recorded by thread ID zero in timing_thread::stop_timer() (one per call,
+    // under the timing_thread's 'name', along with its 'nbytes_accessed').  These functions are thread-safe.
+    void record_sample(const std::string &name, double dt, ssize_t nbytes_accessed=0, bool interference=false);
+    std::vector<double> get_samples(const std::string &name) const;
+    std::vector<std::string> get_sample_names() const;    // in order of first appearance
+    ssize_t get_nbytes_accessed(const std::string &name) const;   // from the most recent sample
+    ssize_t get_num_interference_flagged(const std::string &name) const;   // see timing_thread::monitor_interference
+
+    // Interference monitoring (see timing_thread::monitor_interference).  The thresholds can be
+    // changed before threads are spawned.  Thread i writes interference_reports[i] in stop_timer(),
+    // before the barrier, and thread ID zero reads all of them after the barrier.
+    interference_thresholds interference_limits;
+    std::vector<interference_report> interference_reports;
+
+    // Hardware counters (see timing_thread::use_perf_counters).  Thread i writes perf_values[i] in
+    // stop_timer(), before the barrier, and every thread sums them after the barrier (so that all
+    // counters are reduced without an extra barrier).
+    std::vector<std::array<double,PERF_NCOUNTERS>> perf_values;
+
+    // Initial value of timing_thread::verbose, for threads in this pool.
+    bool verbose = true;
+
+    // Prints min/median/p99/stddev for every benchmark name with at least one sample.
+    void print_statistics(std::ostream &os=std::cout) const;
+
+    // Should be called when no threads are in wait_at_barrier() (e.g. after threads are joined).
+    barrier_skew_stats get_barrier_skew() const;
+    void print_barrier_skew(std::ostream &os=std::cout) const;
+
 protected:
+    double tick_seconds = 1.0e-9;
+
+    // Timing samples.
+    mutable std::mutex sample_lock;
+    std::map<std::string, std::vector<double>> samples;
+    std::map<std::string, ssize_t> sample_nbytes;
+    std::map<std::string, ssize_t> sample_nflagged;
+    std::vector<std::string> sample_names;
+
     // Assigning thread ID's.
     std::mutex thread_id_lock;
     int curr_thread_id = 0;
     
-    // Barrier.
+    // Reduction (all barrier types).  Each arriving thread writes its t-value to barrier_tvals[slot],
+    // where 'slot' is the thread_id (reduce_at_barrier()) or arrival index (wait_at_barrier()).  The
+    // last thread to arrive computes 'barrier_result' before releasing the others.  The result can't
+    // be overwritten until every thread has arrived at the next barrier, so it is safe to read after release.
+    std::unique_ptr<double[]> barrier_tvals;
+    barrier_reduction barrier_result;
+
+    // Barrier (BARRIER_MUTEX).
     std::mutex barrier_lock;
     std::condition_variable barrier_cv;
-    double barrier_tcurr = 0.0;
-    double barrier_tprev = 0.0;
     int barrier_count = 0;
     int barrier_gen = 0;
+
+    // Barrier (BARRIER_SPIN, BARRIER_HYBRID).  Each arriving thread takes a ticket, writes its t-value,
+    // then increments spin_arrived.  The last thread to arrive computes the reduction, and releases the
+    // others by incrementing spin_gen (which is also the futex word).  Padding keeps the frequently-written
+    // atomics on separate cache lines.
+    char _pad0[64];
+    std::atomic<int> spin_ticket;
+    char _pad1[64];
+    std::atomic<int> spin_arrived;
+    char _pad2[64];
+    std::atomic<int> spin_gen;
+    std::atomic<int> spin_nsleepers;
+    char _pad3[64];
+
+    // Barrier exit skew.  Thread with arrival index i writes its exit time to exit_ticks[i].  At the
+    // next barrier, the last thread to arrive computes the skew of the previous one.
+    std::unique_ptr<int64_t[]> exit_ticks;
+    bool exit_ticks_valid = false;
+    ssize_t skew_count = 0;
+    double skew_sum = 0.0;
+    double skew_max = 0.0;
+
+    // Argument 'slot' is thread_id, or -1 to use the arrival index.
+    void _wait_at_mutex_barrier(double t, int slot);
+    void _wait_at_spin_barrier(double t, int slot);
+    void _reduce_barrier_tvals();
+    void _update_barrier_skew();
+};
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// Combining-tree allreduce.
+//
+//   // Shared by all threads, and constructed before they start.
+//   tree_allreduce<std::array<double,4>> r(*pool);
+//
+//   // Thread-collective, e.g. in timing_thread::thread_body().
+//   std::array<double,4> totals = r.allreduce(thread_id, local_counts, allreduce_sum());
+//
+// In timing_thread_pool::wait_at_barrier(), every thread arrives at the same lock (or atomic), and
+// only one double is reduced.  Here, threads arrive at the leaves of a tree whose levels follow the
+// topology: SMT siblings of a physical core, then cores of a package, then packages.  Levels with more
+// than 'max_fanin' children are split into subtrees.  The last thread to arrive at a node combines its
+// children's values and continues to the parent, so no cache line is written by more than max_fanin
+// threads.  The thread which completes the root publishes the result, and releases the other threads
+// (which spin briefly, then sleep on a futex, as in BARRIER_HYBRID).
+//
+// T must be trivially copyable: a scalar, a small fixed-length std::array, or a plain struct.  The
+// operator must be associative and commutative.  Values are always combined in the same order (which
+// depends only on the tree), so e.g. floating-point sums are reproducible between calls.
+
+
+// Base class of tree_allreduce<T>, containing the tree structure and synchronization.
+class allreduce_tree {
+public:
+    const int nthreads;
+    const int max_fanin;
+
+    int num_nodes() const { return nodes.size(); }
+    int depth() const { return tree_depth; }    // max number of nodes between a thread and the root (inclusive)
+
+    // Helper for constructors: thread i -> cpu_info of pool.cpus[i].
+    static std::vector<cpu_info> get_thread_cpus(const timing_thread_pool &pool);
+
+protected:
+    // Thread i is assumed to run on thread_cpus[i] (only the 'package' and 'core' fields are used).
+    // Each node's values are padded to a separate cache line, using 'value_nbytes'.
+    allreduce_tree(const std::vector<cpu_info> &thread_cpus, int max_fanin, ssize_t value_nbytes);
+
+    struct node {
+	int parent = -1;        // -1 for the root
+	int slot = 0;           // index of this node among the parent's children
+	int nchildren = 0;
+	int value_offset = 0;   // children's values are in [value_offset, value_offset + nchildren)
+    };
+
+    std::vector<node> nodes;
+    std::vector<int> leaf_node;   // thread i arrives at nodes[leaf_node[i]], as child leaf_slot[i]
+    std::vector<int> leaf_slot;
+    int tree_depth = 0;
+    int nvalues = 0;              // including padding
+
+    // Arrival counters, one per node, on separate cache lines.
+    struct padded_counter {
+	std::atomic<int> n;
+	char _pad[64 - sizeof(std::atomic<int>)];
+    };
+
+    std::unique_ptr<padded_counter[]> counters;
+
+    char _pad0[64];
+    std::atomic<int> gen;
+    std::atomic<int> nsleepers;
+    char _pad1[64];
+
+    // Returns true if the caller is the last thread to arrive at nodes[n] (and resets its counter).
+    inline bool _arrive(int n)
+    {
+	if (counters[n].n.fetch_add(1, std::memory_order_acq_rel) != nodes[n].nchildren - 1)
+	    return false;
+	counters[n].n.store(0, std::memory_order_relaxed);
+	return true;
+    }
+
+    void _check_thread_id(int thread_id) const;
+    void _release(int g);   // called by the thread which completes the root
+    void _wait(int g);      // called by all other threads
+
+    // Builds the tree.  Child IDs are node indices (>= 0), or (-1-thread_id) for threads.
+    int _make_node(const std::vector<int> &children);
+    int _combine(const std::vector<int> &items);
+};
+
+
+template<typename T>
+class tree_allreduce : public allreduce_tree {
+public:
+    static_assert(std::is_trivially_copyable<T>::value, "tree_allreduce<T>: T must be trivially copyable");
+
+    tree_allreduce(const std::vector<cpu_info> &thread_cpus, int max_fanin=8) :
+	allreduce_tree(thread_cpus, max_fanin, sizeof(T)), values(nvalues) { }
+
+    tree_allreduce(const timing_thread_pool &pool, int max_fanin=8) :
+	tree_allreduce(get_thread_cpus(pool), max_fanin) { }
+
+    // Thread-collective: each thread passes its own (distinct) thread_id, in 0 <= thread_id < nthreads.
+    // Returns op(x_0, op(x_1, ...)) on all threads.
+    template<typename Op>
+    T allreduce(int thread_id, const T &x, const Op &op)
+    {
+	_check_thread_id(thread_id);
+
+	// We can read 'gen' before arriving: it can't advance until this thread has arrived.
+	int g = gen.load(std::memory_order_acquire);
+	int n = leaf_node[thread_id];
+	int s = leaf_slot[thread_id];
+	T v = x;
+
+	for (;;) {
+	    const node &nd = nodes[n];
+	    values[nd.value_offset + s] = v;
+
+	    if (!_arrive(n))
+		break;
+
+	    v = values[nd.value_offset];
+	    for (int i = 1; i < nd.nchildren; i++)
+		v = op(v, values[nd.value_offset + i]);
+
+	    if (nd.parent < 0) {
+		// Can't be overwritten until every thread has arrived at the next allreduce.
+		result = v;
+		_release(g);
+		return v;
+	    }
+
+	    s = nd.slot;
+	    n = nd.parent;
+	}
+
+	_wait(g);
+	return result;
+    }
+
+protected:
+    std::vector<T> values;
+    T result;
+};
+
+
+// Operators for tree_allreduce.  Also work elementwise on std::array.
+struct allreduce_sum {
+    template<typename T> T operator()(const T &x, const T &y) const { return x + y; }
+
+    template<typename T, size_t N>
+    std::array<T,N> operator()(const std::array<T,N> &x, const std::array<T,N> &y) const
+    {
+	std::array<T,N> ret;
+	for (size_t i = 0; i < N; i++)
+	    ret[i] = x[i] + y[i];
+	return ret;
+    }
+};
+
+struct allreduce_min {
+    template<typename T> T operator()(const T &x, const T &y) const { return (y < x) ? y : x; }
+
+    template<typename T, size_t N>
+    std::array<T,N> operator()(const std::array<T,N> &x, const std::array<T,N> &y) const
+    {
+	std::array<T,N> ret;
+	for (size_t i = 0; i < N; i++)
+	    ret[i] = (y[i] < x[i]) ? y[i] : x[i];
+	return ret;
+    }
+};
+
+struct allreduce_max {
+    template<typename T> T operator()(const T &x, const T &y) const { return (y > x) ? y : x; }
+
+    template<typename T, size_t N>
+    std::array<T,N> operator()(const std::array<T,N> &x, const std::array<T,N> &y) const
+    {
+	std::array<T,N> ret;
+	for (size_t i = 0; i < N; i++)
+	    ret[i] = (y[i] > x[i]) ? y[i] : x[i];
+	return ret;
+    }
 };
 
 
@@ -51,6 +411,34 @@ public:
     ssize_t nbytes_accessed = 0;
     ssize_t floating_point_ops = 0;
 
+    // Result of warm_up_cpu(), if called (printed on thread ID zero).
+    warm_up_result warm_up;
+
+    // If 'use_perf_counters' is true, then hardware counters (cycles, instructions, LLC/branch/TLB misses)
+    // are collected while the timer is running, summed over threads in stop_timer(), and printed along
+    // with the timing.  Must be set to the same value on all threads.  Note that pause_timer() and
+    // unpause_timer() each cost an extra syscall (~1 usec) when counters are enabled.
+    bool use_perf_counters = false;
+
+    // If 'monitor_interference' is true, then cpufreq, thermal throttling, interrupts and context switches
+    // are sampled on each thread around every timed region (outside the timed interval; see
+    // interference_monitor.hpp).  Regions where any thread exceeds pool->interference_limits are
+    // flagged in the output, and counted in pool->get_num_interference_flagged().  Must be set to the
+    // same value on all threads.  Costs tens of microseconds per start_timer()/stop_timer() pair.
+    bool monitor_interference = false;
+
+    // If 'histogram' is non-null, then each thread records its own 'local_dt' (in nanoseconds) in every
+    // stop_timer(), into shard (thread_id % histogram->nshards), so that percentiles can be tracked over
+    // any number of trials in fixed memory.  The histogram can be shared between threads (and should
+    // then have nthreads shards), and is never reset by timing_thread.  Its percentiles are printed on
+    // thread ID zero after run_trials().
+    std::shared_ptr<latency_histogram> histogram;
+
+    // If 'verbose' is false, nothing is printed (including the warm-up result, if set in the
+    // subclass constructor), but timing samples are still recorded in the pool.  The initial value
+    // is taken from timing_thread_pool::verbose.
+    bool verbose = true;
+
     static void _thread_main(timing_thread *t);
 
     virtual ~timing_thread() { }
@@ -60,23 +448,76 @@ protected:
 
     virtual void thread_body() = 0;
 
-    struct timeval start_time;
+    int64_t start_ticks = 0;
     bool timer_is_running = false;
+    bool print_each_trial = true;
     
     double local_dt = 0.0;
-    double global_dt = 0.0;
+    double global_dt = 0.0;     // mean over threads of local_dt
+
+    // Per-thread 'local_dt' values from the most recent stop_timer(), for load-imbalance reporting.
+    // The imbalance ratio is max/mean: 1.0 means perfectly balanced.
+    barrier_reduction dt_reduction;
+
+    // Name of the timed region in the trace (see trace.hpp), set in start_timer() if tracing is enabled.
+    // 'trace_region_name' is the value of 'name' which 'trace_region' was interned from.
+    const char *trace_region = "timed region";
+    std::string trace_region_name;
+
+    // If monitor_interference=true.
+    interference_snapshot interference_start;
+    std::string interference_description;   // on thread ID zero, after stop_timer(): empty if not flagged
+
+    // Load imbalance and interference over the trials in run_trials(), tracked on thread ID zero.
+    int trial_nflagged = 0;
+    std::string trial_flagged_example;
+    double trial_max_imbalance = 0.0;
+    std::vector<int> trial_straggler_counts;   // length nthreads: number of trials in which each thread was slowest
+
+    // Hardware counters (if use_perf_counters=true).  After stop_timer(), 'perf_totals' contains the
+    // sum over all threads.  Use perf->available(id) to check whether a counter is supported.
+    std::unique_ptr<perf_counters> perf;
+    double perf_totals[PERF_NCOUNTERS];
     
     // Thread-collective: all threads wait at a barrier, then start their local timers.
     void start_timer();
     
     // Thread-collective: snychronizes and computes 'global_dt', the average running time on all threads.
-    // If 'name' is non-null, then timing will be announced on thread ID zero.
+    // If 'name' is non-null, then timing will be announced on thread ID zero, along with the
+    // load imbalance (max/mean and min/mean of per-thread times, and the slowest thread).
     void stop_timer();
 
     // Temporarily pause local timer, if there is some processing which should
     // be excluded from the timing.  (Not thread-collective.)
     void pause_timer();
     void unpause_timer();
+
+    // Thread-collective: calls start_timer(), f(), stop_timer() 'ntrials' times, then prints
+    // min/median/p99/stddev of 'global_dt' over trials on thread ID zero (if 'name' is nonempty),
+    // followed by the worst load imbalance and the thread which was most often slowest.
+    template<typename F>
+    void run_trials(int ntrials, const F &f)
+    {
+	this->print_each_trial = false;
+	this->trial_max_imbalance = 0.0;
+	this->trial_straggler_counts.assign(nthreads, 0);
+	this->trial_nflagged = 0;
+	this->trial_flagged_example.clear();
+
+	for (int i = 0; i < ntrials; i++) {
+	    this->start_timer();
+	    f();
+	    this->stop_timer();
+	}
+
+	this->print_each_trial = true;
+	this->_print_trials(ntrials);
+    }
+
+    void _print_trials(int ntrials);
+    std::string _describe_thread(int id) const;   // "thread N (cpu M)"
+    void _update_interference();
+    void _print_perf_totals();
 };
 
 
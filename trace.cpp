@@ -0,0 +1,284 @@
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <unordered_set>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "trace.hpp"
+#include "time.hpp"
+#include "timing_thread.hpp"
+
+using namespace std;
+
+
+atomic<bool> _trace_enabled(false);
+
+// Set in start_tracing(), before _trace_enabled (see the fence in _trace_record()).
+static bool trace_use_tsc = false;
+
+
+struct trace_event {
+    int64_t ticks;
+    const char *name;
+    char phase;    // 'B', 'E' or 'i', as in the Chrome trace format
+};
+
+
+// Written only by the owning thread.  Readers see a consistent prefix, since each event is written
+// before 'nevents' is incremented (release), and a new chunk is initialized before it is linked.
+struct trace_chunk {
+    static const int capacity = 4096;
+
+    trace_event events[capacity];
+    atomic<int> nevents;
+    atomic<trace_chunk *> next;
+
+    trace_chunk() : nevents(0), next(nullptr) { }
+};
+
+
+struct trace_buffer {
+    int tid = 0;
+    string thread_name;          // protected by trace_state::lock
+    trace_chunk head;
+    trace_chunk *tail = &head;   // only accessed by the owning thread (or clear_trace())
+
+    void free_chunks()
+    {
+	trace_chunk *c = head.next.load();
+	while (c) {
+	    trace_chunk *next = c->next.load();
+	    delete c;
+	    c = next;
+	}
+
+	head.next.store(nullptr);
+	head.nevents.store(0);
+	tail = &head;
+    }
+
+    ~trace_buffer() { free_chunks(); }
+};
+
+
+struct trace_state {
+    mutex lock;
+
+    // Buffers are never freed (only cleared), so that events outlive their threads.
+    vector<unique_ptr<trace_buffer>> buffers;
+
+    // Interned names (pointers to elements of an unordered_set are stable).
+    unordered_set<string> names;
+
+    int64_t t0 = 0;
+    double ticks_per_second = 1.0e9;
+    bool started = false;
+    string filename;
+    bool atexit_registered = false;
+};
+
+
+// Function-local static, so that events can be recorded from static initializers.
+static trace_state &get_trace_state()
+{
+    static trace_state s;
+    return s;
+}
+
+
+static thread_local trace_buffer *tls_buffer = nullptr;
+static thread_local string tls_thread_name;
+
+
+static trace_buffer *register_thread()
+{
+    trace_state &s = get_trace_state();
+    lock_guard<mutex> l(s.lock);
+
+    trace_buffer *b = new trace_buffer;
+    b->tid = s.buffers.size();
+    b->thread_name = (tls_thread_name.size() > 0) ? tls_thread_name : ("thread " + to_string(b->tid));
+    s.buffers.push_back(unique_ptr<trace_buffer> (b));
+
+    tls_buffer = b;
+    return b;
+}
+
+
+void _trace_record(const char *name, char phase)
+{
+    // Pairs with the store to _trace_enabled in start_tracing(), so that 'trace_use_tsc' is visible.
+    atomic_thread_fence(memory_order_acquire);
+
+    int64_t ticks = trace_use_tsc ? int64_t(read_tsc()) : get_monotonic_ns();
+    trace_buffer *b = tls_buffer ? tls_buffer : register_thread();
+    trace_chunk *c = b->tail;
+    int n = c->nevents.load(memory_order_relaxed);
+
+    if (n == trace_chunk::capacity) {
+	trace_chunk *next = new trace_chunk;
+	c->next.store(next, memory_order_release);
+	b->tail = c = next;
+	n = 0;
+    }
+
+    trace_event &e = c->events[n];
+    e.ticks = ticks;
+    e.name = name;
+    e.phase = phase;
+
+    c->nevents.store(n+1, memory_order_release);
+}
+
+
+static void write_trace_at_exit()
+{
+    trace_state &s = get_trace_state();
+    _trace_enabled.store(false);
+
+    if (s.filename.size() == 0)
+	return;
+
+    try {
+	write_trace_json(s.filename);
+    } catch (std::exception &e) {
+	cerr << "warning: " << e.what() << endl;
+    }
+}
+
+
+void start_tracing(const string &filename)
+{
+    trace_state &s = get_trace_state();
+
+    {
+	lock_guard<mutex> l(s.lock);
+
+	if (!s.started) {
+	    double tsc_rate = get_tsc_ticks_per_second();
+	    trace_use_tsc = (tsc_rate > 0.0);
+	    s.ticks_per_second = trace_use_tsc ? tsc_rate : 1.0e9;
+	    s.t0 = trace_use_tsc ? int64_t(read_tsc()) : get_monotonic_ns();
+	    s.started = true;
+	}
+
+	if (filename.size() > 0)
+	    s.filename = filename;
+
+	// Registered after get_trace_state() has been constructed, so it runs before the destructor.
+	if ((s.filename.size() > 0) && !s.atexit_registered) {
+	    atexit(write_trace_at_exit);
+	    s.atexit_registered = true;
+	}
+    }
+
+    _trace_enabled.store(true);
+}
+
+
+void stop_tracing()
+{
+    _trace_enabled.store(false);
+}
+
+
+void clear_trace()
+{
+    trace_state &s = get_trace_state();
+    lock_guard<mutex> l(s.lock);
+
+    for (auto &b: s.buffers)
+	b->free_chunks();
+}
+
+
+void set_trace_thread_name(const string &name)
+{
+    tls_thread_name = name;
+
+    if (tls_buffer) {
+	lock_guard<mutex> l(get_trace_state().lock);
+	tls_buffer->thread_name = name;
+    }
+}
+
+
+const char *trace_intern(const string &name)
+{
+    trace_state &s = get_trace_state();
+    lock_guard<mutex> l(s.lock);
+    return s.names.insert(name).first->c_str();
+}
+
+
+static string json_escape(const char *s)
+{
+    stringstream ss;
+    ss << '"';
+
+    for ( ; *s; s++) {
+	if ((*s == '"') || (*s == '\\'))
+	    ss << '\\' << *s;
+	else if ((unsigned char)(*s) < 0x20)
+	    ss << "\\u" << hex << setw(4) << setfill('0') << int(*s) << dec << setfill(' ');
+	else
+	    ss << *s;
+    }
+
+    ss << '"';
+    return ss.str();
+}
+
+
+void write_trace_json(ostream &os)
+{
+    trace_state &s = get_trace_state();
+    lock_guard<mutex> l(s.lock);
+
+    // Timestamps are in microseconds, relative to the first start_tracing().
+    double us_per_tick = 1.0e6 / s.ticks_per_second;
+    int pid = getpid();
+    bool first = true;
+
+    auto flags = os.flags();
+    auto prec = os.precision(3);
+    os << fixed << "{\n  \"displayTimeUnit\": \"ns\",\n  \"traceEvents\": [";
+
+    for (const auto &b: s.buffers) {
+	os << (first ? "\n    " : ",\n    ") << "{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+	   << ", \"tid\": " << b->tid << ", \"args\": { \"name\": " << json_escape(b->thread_name.c_str()) << " } }";
+	first = false;
+
+	for (trace_chunk *c = &b->head; c; c = c->next.load(memory_order_acquire)) {
+	    int n = c->nevents.load(memory_order_acquire);
+
+	    for (int i = 0; i < n; i++) {
+		const trace_event &e = c->events[i];
+		os << ",\n    { \"name\": " << json_escape(e.name) << ", \"ph\": \"" << e.phase << "\""
+		   << ", \"ts\": " << ((e.ticks - s.t0) * us_per_tick) << ", \"pid\": " << pid << ", \"tid\": " << b->tid;
+		if (e.phase == 'i')
+		    os << ", \"s\": \"t\"";    // thread-scoped instant event
+		os << " }";
+	    }
+	}
+    }
+
+    os << "\n  ]\n}" << endl;
+    os.precision(prec);
+    os.flags(flags);
+}
+
+
+void write_trace_json(const string &filename)
+{
+    ofstream f(filename);
+    if (!f)
+	throw runtime_error("write_trace_json(): couldn't open '" + filename + "'");
+
+    write_trace_json(f);
+}
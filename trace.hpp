@@ -0,0 +1,111 @@
+#ifndef _TRACE_HPP
+#define _TRACE_HPP
+
+#include <string>
+#include <atomic>
+#include <iostream>
+#include <stdint.h>
+
+
+// -------------------------------------------------------------------------------------------------
+//
+// Timeline tracing, with export to Chrome/Perfetto trace JSON (chrome://tracing or ui.perfetto.dev).
+//
+//   start_tracing("trace.json");    // events are only recorded between start_tracing() and stop_tracing()
+//
+//   {
+//       TRACE_SCOPE("fft");         // begin/end span for the enclosing scope
+//       ...
+//   }
+//
+//   TRACE_BEGIN("dedisperse");      // explicit begin/end spans (must nest, per thread)
+//   TRACE_END("dedisperse");
+//   TRACE_INSTANT("buffer full");
+//
+//   write_trace_json("trace.json");  // on demand (also written at exit, if a filename was given above)
+//
+// Each thread records into its own buffer, so recording takes no locks (except when a thread records
+// its first event, or fills a 4096-event chunk).  Timestamps are from the calibrated TSC where available
+// (see get_tsc_ticks_per_second() in timing_thread.hpp), otherwise from get_monotonic_ns().  A recorded
+// event costs tens of nanoseconds (mostly reading the clock), and an event while tracing is stopped
+// costs one relaxed atomic load.  Buffers grow without bound (24 bytes/event) until clear_trace() is called.
+//
+// Event names are stored as pointers, so they must outlive the trace: use string literals, or
+// trace_intern() for names which are constructed at runtime.
+//
+// timing_thread records spans for its timed regions (under the timing_thread's 'name') and for the
+// barriers in start_timer() and stop_timer(), so waiting time shows up in the trace.
+//
+// If compiled with -DNO_TRACING, the TRACE_* macros expand to nothing and tracing is removed entirely
+// (start_tracing() etc. still exist, but no events are recorded).  As with MEMORY_ACCOUNTING, all
+// translation units should agree on whether NO_TRACING is defined.
+
+
+extern void start_tracing(const std::string &filename="");   // if filename is nonempty, trace is written at exit
+extern void stop_tracing();
+
+// Discards all recorded events.  Must not be called while other threads are recording events.
+extern void clear_trace();
+
+// Can be called while other threads are recording (events recorded after the call starts may or
+// may not be included).  Throws an exception if the file can't be opened.
+extern void write_trace_json(std::ostream &os);
+extern void write_trace_json(const std::string &filename);
+
+// Thread name shown in the trace viewer (default "thread N", in order of first event).
+extern void set_trace_thread_name(const std::string &name);
+
+// Returns a pointer to a copy of 's' which is never freed (the same pointer for equal strings).
+// Thread-safe, but takes a lock.
+extern const char *trace_intern(const std::string &s);
+
+extern std::atomic<bool> _trace_enabled;
+extern void _trace_record(const char *name, char phase);
+
+
+#ifndef NO_TRACING
+
+inline bool trace_enabled() { return _trace_enabled.load(std::memory_order_relaxed); }
+
+inline void trace_begin(const char *name) { if (trace_enabled()) _trace_record(name, 'B'); }
+inline void trace_end(const char *name) { if (trace_enabled()) _trace_record(name, 'E'); }
+inline void trace_instant(const char *name) { if (trace_enabled()) _trace_record(name, 'i'); }
+
+#define TRACE_BEGIN(name) trace_begin(name)
+#define TRACE_END(name) trace_end(name)
+#define TRACE_INSTANT(name) trace_instant(name)
+#define TRACE_SCOPE(name) trace_scope _TRACE_CONCAT(_trace_scope_, __LINE__) (name)
+
+#else  // NO_TRACING
+
+inline bool trace_enabled() { return false; }
+
+inline void trace_begin(const char *name) { }
+inline void trace_end(const char *name) { }
+inline void trace_instant(const char *name) { }
+
+#define TRACE_BEGIN(name) do { } while (0)
+#define TRACE_END(name) do { } while (0)
+#define TRACE_INSTANT(name) do { } while (0)
+#define TRACE_SCOPE(name) do { } while (0)
+
+#endif  // NO_TRACING
+
+
+#define _TRACE_CONCAT2(x, y) x ## y
+#define _TRACE_CONCAT(x, y) _TRACE_CONCAT2(x, y)
+
+
+// RAII span, used by TRACE_SCOPE().
+struct trace_scope {
+    const char *name;
+
+    trace_scope(const char *name_) : name(name_) { trace_begin(name); }
+    ~trace_scope() { trace_end(name); }
+
+    trace_scope(const trace_scope &) = delete;
+    trace_scope &operator=(const trace_scope &) = delete;
+};
+
+
+#endif  // _TRACE_HPP